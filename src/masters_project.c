@@ -13,7 +13,9 @@
  */
 
 // Includes
+#define _GNU_SOURCE              // pthread_setaffinity_np() and friends.
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,35 +25,48 @@
 #include <unistd.h>
 #include "lz4/lz4.h"
 #include "zlib/zlib.h"
+#define ZSTD_STATIC_LINKING_ONLY  // ZSTD_getCParams(), ZSTD_adjustCParams(), ZSTD_compress_advanced().
 #include "zstd/zstd.h"
 #include <time.h>
-#include <libgen.h>
 #include <locale.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>        // _mm_clflush() for --cache cold.
+#endif
 
 
 // Structs
+enum direction {PHASE_COMP, PHASE_DECOMP, DIRECTIONS};  // Each codec is timed in two phases; phase = codec * 2 + direction.
+enum output_format {FORMAT_TABLE, FORMAT_CSV, FORMAT_JSON};
+enum cache_mode {CACHE_AS_IS, CACHE_HOT, CACHE_COLD, CACHE_EVICT};  // What the caches hold when a phase's clock starts.
+enum perf_counter {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES,
+                   PERF_EVENTS};
+#define HIST_SUB_BITS        4   // 16 linear sub-buckets per power of two, so any bucket is within ~6% of its values.
+#define HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+#define MAX_CODECS          128  // Codec configurations per run: a --sweep (38) plus --codecs, twinned by --reuse-contexts.
+typedef struct histogram histogram;
+struct histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+};
 typedef struct src_file src_file;
 struct src_file {
   char     *filespec;  // The path to the file, fully qualified.
+  char     *name;      // Tail of *filespec below the scanned folder; what the table shows.
   void     *data;      // The data.
   uint64_t size;   // The length of the data.
-};
-typedef struct result result;
-struct result {
-  src_file *src;  // Just link to the original since it should live the whole program life.
-  int      block_size;
-  int      blocks;
-  uint64_t memcpy_time;
-  uint64_t lz4_comp_size;
-  uint64_t lz4_comp_time;
-  uint64_t lz4_decomp_time;
-  uint64_t zlib_comp_size;
-  uint64_t zlib_comp_time;
-  uint64_t zlib_decomp_time;
-  uint64_t zstd_comp_size;
-  uint64_t zstd_comp_time;
-  uint64_t zstd_decomp_time;
-  pthread_mutex_t lock;
+  int      mapped;     // 1 when *data is a read-only mmap of the file rather than a heap copy.
 };
 typedef struct buffer buffer;
 struct buffer {
@@ -59,35 +74,290 @@ struct buffer {
   void     *compressed;
   void     *decompressed;
   uint64_t raw_size;
+  uint64_t comp_bound;  // Capacity of *compressed; the largest bound of all active codecs for raw_size.
   int64_t  comp_size;
 };
+typedef struct codec codec;
+struct codec {
+  char     name[32];    // As given to --codecs and written to csv/json, e.g. "zstd" or "zstd:19".
+  char     label[24];   // Table column heading.
+  int      level;       // Compression level, or acceleration for LZ4; only the codec's own functions interpret it.
+  int      min_level;
+  int      max_level;
+  void     *(*init)(codec *self);                                 // Per-worker state, made once per thread.  May be NULL.
+  int64_t  (*compress)(codec *self, void *state, buffer *buf);    // raw -> compressed.  Compressed size, or < 0.
+  int64_t  (*decompress)(codec *self, void *state, buffer *buf);  // compressed -> decompressed.  Raw size, or < 0.
+  uint64_t (*bound)(codec *self, uint64_t raw_size);             // Worst-case compressed size.
+  void     (*teardown)(codec *self, void *state);                 // May be NULL.
+  char     *baseline;   // For a variant, the kind it's measured against at the same level (e.g. "zstd"); else NULL.
+  int      kind;        // Index into codec_kinds[].
+  void     *(*prepare)(codec *self);                              // Read-only data all workers share, made once in
+  void     (*release)(codec *self, void *shared);                 // main() from the trained dictionary.  May be NULL.
+  void     *shared;     // Whatever prepare() returned.
+};
+typedef struct codec_result codec_result;
+struct codec_result {
+  uint64_t comp_size;
+  uint64_t comp_time;
+  uint64_t decomp_time;
+  uint64_t counters[DIRECTIONS][PERF_EVENTS];  // Hardware counter totals with --perf (scaled if multiplexed).
+  uint64_t faults[DIRECTIONS];                 // Page faults (minor + major) the workers took inside each phase.
+  uint64_t cpu_time[DIRECTIONS];               // Thread CPU nanoseconds inside each phase, summed over the workers.
+  uint64_t entered[DIRECTIONS];                // CLOCK_MONOTONIC ns the first worker started each phase this trial...
+  uint64_t left[DIRECTIONS];                   // ...and the last one finished it.
+  uint64_t phase_wall[DIRECTIONS];             // left - entered, summed over trials: the phase's real wall time.
+  uint64_t codec_wall;                         // The same over both directions, i.e. first worker in to last out.
+};
+typedef struct result result;
+struct result {
+  src_file *src;  // Just link to the original since it should live the whole program life.
+  uint64_t block_size;
+  uint64_t blocks;      // Blocks this result covers; for a per-worker slot, the blocks that worker ran.
+  uint64_t raw_size;    // Input bytes this result covers.
+  histogram *latency;   // PHASE_COUNT per-block latency histograms with --latency, otherwise NULL.
+  uint64_t wall_time;   // Nanoseconds of wall clock the cell took, summed over its trials.
+  uint64_t cpu_time;    // Thread CPU nanoseconds spent on it by every worker involved, summed over its trials.
+  int      trials;      // Trials folded into it (--trials / --min-time); 1 until fold_trials() says otherwise.
+  codec_result codecs[MAX_CODECS];  // Indexed like codecs[]; only the first CODEC_COUNT are used.
+} __attribute__((aligned(64)));  // Workers each own one; keep neighbours in an array off each other's cache lines.
+typedef struct arena arena;
+struct arena {
+  void     *base;      // One big anonymous mapping, carved up into buffers.
+  uint64_t capacity;   // Bytes mapped at *base.
+  uint64_t used;       // Bytes handed out since the last reset.
+};
+typedef struct dictionary dictionary;
+struct dictionary {
+  void     *content;      // Raw-content dictionary, most useful material last.
+  uint64_t size;
+  uint64_t samples;       // Pieces read from the corpus to train it.
+  uint64_t sample_bytes;
+  uint64_t build_time;    // Nanoseconds for sampling and training together.
+  uint64_t prepare_time;  // Nanoseconds the codecs spent digesting it (CDict/DDict and the like).
+};
+typedef struct dict_segment dict_segment;
+struct dict_segment {
+  uint64_t start;   // Offset into the training samples.
+  uint64_t score;   // Sum of the frequencies of its distinct d-mers when it was chosen.
+};
+typedef struct workspace workspace;
+struct workspace {
+  arena    arena;      // Backs the raw/compressed/decompressed slices of bufs[].
+  buffer   *bufs;      // Grown to the largest block count seen; the slices themselves live in the arena.
+  uint64_t capacity;
+};
+typedef struct chunk_deque chunk_deque;
+struct chunk_deque {
+  pthread_mutex_t lock;
+  int64_t         head;   // Next chunk the owner takes, walking forward through its share.
+  int64_t         tail;   // One past the last chunk; thieves take from here so they stay out of the owner's way.
+} __attribute__((aligned(64)));
+typedef struct phase_sync phase_sync;
+struct phase_sync {
+  pthread_barrier_t barrier;   // Every worker meets here before and after each phase.
+  struct timespec   start;     // Taken by whichever worker the opening barrier picks.
+  uint64_t wall[MAX_CODECS * DIRECTIONS];  // Per phase: wall time from the opening to the closing barrier.
+};
 typedef struct test_wrapper test_wrapper;
 struct test_wrapper {
   result *res;
-  int buffer_count;
-  src_file *src;
-  int block_size;
-  int s_idx;
-  int e_idx;
+  uint64_t buffer_count;
+  buffer *set;
+  uint64_t block_size;
+  chunk_deque *deques;    // One per worker for each codec (codec * THREADS + worker), shared by all wrappers of a cell.
+  uint64_t chunk_blocks;
+  int *order;             // The codec order every worker follows this trial.
+  uint64_t busy_time;     // Nanoseconds this worker spent running chunks.
+  phase_sync *sync;       // --sync-phases: shared by all wrappers of a cell, NULL otherwise.
+  pthread_barrier_t *codec_done;  // Otherwise: met after each codec, so none starts while another's chunks are in flight.
+  int chunks_run;
+  int chunks_stolen;
+};
+typedef void (*pool_job)(void *arg, int worker_id);
+typedef struct worker_pool worker_pool;
+struct worker_pool {
+  pthread_t       *threads;
+  int             size;
+  int             started;      // Workers that have pinned themselves and are waiting for work.
+  pool_job        job;          // Current job; every worker runs it once per generation with its own worker_id.
+  void            *arg;
+  uint64_t        generation;   // Bumped by pool_run() to release the workers.
+  int             pending;      // Workers still inside the current job.
+  int             shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t  job_ready;
+  pthread_cond_t  job_done;
+};
+typedef struct pool_seat pool_seat;
+struct pool_seat {
+  worker_pool *pool;
+  int         worker_id;
+};
+typedef struct warmup_report warmup_report;
+struct warmup_report {
+  double   rate;       // Iterations per second over the final window.
+  uint64_t elapsed;    // Nanoseconds spent warming.
+  int      windows;
+  int      stable;     // 1 if the rate settled, 0 if we hit the cap.
+};
+typedef struct trial_stats trial_stats;
+struct trial_stats {
+  int    kept;
+  int    rejected;     // Trials dropped as outliers (modified z-score over OUTLIER_Z).
+  double median;
+  double mean;
+  double stddev;
+  double min;
+  double ci95;         // Half-width of the 95% confidence interval of the mean.
+};
+typedef struct prefetcher prefetcher;
+struct prefetcher {
+  src_file        *files;
+  int             file_count;
+  int             loaded;      // Files [0, loaded) are in memory (or were, until released).
+  uint64_t        resident;    // Bytes loaded, or being loaded, and not yet released.
+  uint64_t        *reserved;   // Per file, what it added to resident; released as-is even if the file changed size.
+  cpu_set_t       spare;       // CPUs no worker is pinned to; the loader only runs on these.
+  uint64_t        budget;      // 0 == no loader thread; prefetch_wait() loads inline.
+  int             stop;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  changed;
+};
+typedef struct cell cell;
+struct cell {
+  src_file    *src;
+  int         file_index;
+  int         block_id;     // Index into BLOCK_SIZES.
+  uint64_t    block_size;
+  result      *res;         // Filled by whichever worker ran the cell; freed once printed.
+  trial_stats *stats;       // PHASE_COUNT entries, alongside res.
+  int         trials;
+  int         worker_id;
+  int         done;
+};
+typedef struct cell_queue cell_queue;
+struct cell_queue {
+  cell            *cells;       // Every (file, block size) pair, in print order.
+  int             cell_count;
+  int             next;         // Next cell a worker takes.
+  int             printed;      // Cells [0, printed) are out; the rest wait for their predecessors.
+  int             *remaining;   // Per file, cells not yet finished; the file is released at 0.
+  workspace       *spaces;      // One per worker.
+  prefetcher      *prefetch;
+  result          *totals;      // Per block size, for the end-of-run summaries.
+  pthread_mutex_t lock;
+};
+typedef struct stream_slot stream_slot;
+struct stream_slot {
+  buffer   buf;        // One block's worth of raw/compressed/decompressed space.
+  result   res;        // Timings and sizes for the block currently in the slot; the sink folds these into the cell.
+  int      worker_id;  // Who compressed it, so the sink can keep per-worker totals too.
+  uint64_t index;      // Block number within the file; keys the block's codec order under --shuffle-codecs.
+};
+typedef struct slot_queue slot_queue;
+struct slot_queue {
+  stream_slot     **items;
+  int             capacity;
+  int             head;
+  int             count;
+  pthread_mutex_t lock;
+  pthread_cond_t  not_empty;
+  pthread_cond_t  not_full;
+};
+typedef struct stream_pipeline stream_pipeline;
+struct stream_pipeline {
+  src_file    *src;
+  int         fd;
+  uint64_t    block_size;
+  uint64_t    block_count;
+  stream_slot *slots;
+  slot_queue  free_slots;   // Sink -> reader.
+  slot_queue  filled;       // Reader -> workers.  NULL entries tell a worker to exit.
+  slot_queue  done;         // Workers -> sink.
+  result      *res;
+  result      *worker_res;  // THREADS entries, only touched by the sink.
 };
 
 
 // Defines & Globals
 #define E_GENERIC            1
 #define E_IO                 2
-#define MAX_FILES           32
-#define MAX_BUFFERS     500000   // This is 500,000 * 2048 bytes == 1GB maximum supported file.
 #define THOUSAND          1000L
 #define MILLION        1000000L
 #define BILLION     1000000000L
-#define BLOCK_COUNT          5
+#define MIN_BLOCK_SIZE     512
+#define PREFETCH_MB       1024   // Default --prefetch budget.
+#define DEFAULT_BLOCK_SIZES "4K-64K"
 #define ZSTD_LEVEL           3   // ZSTD Default
 #define ZLIB_LEVEL           6   // Gzip Default
-#define WARMUP_SEC          30   // Seconds
-const int block_sizes[BLOCK_COUNT] = {4096, 8192, 16384, 32768, 65536};
-buffer bufs[MAX_BUFFERS];        // Yep.  Get over it.
+#define LZ4_ACCELERATION     1   // LZ4_compress_default()
+#define PHASE_COUNT         (CODEC_COUNT * DIRECTIONS)
+#define DEFAULT_CODECS      "memcpy,lz4,zlib,zstd"
+#define LZ4_SWEEP_MAX       64   // --sweep doubles the LZ4 acceleration from 1 up to this.
+#define WARMUP_SEC          30   // Seconds; the cap for the adaptive warm-up.
+#define WARMUP_WINDOW_MS   250   // Length of one throughput sample.
+#define WARMUP_WINDOWS       4   // Consecutive samples that must agree before we call the core steady.
+#define MAX_TRIALS       10000   // Hard stop for --min-time on very fast cells.
+#define OUTLIER_Z          3.5   // Iglewicz & Hoaglin's cut-off for the MAD-based modified z-score.
+#define OUTLIER_MIN_TRIALS   5   // Below this the MAD is too fragile to reject anything.
+#define ARENA_ALIGN         64   // Cache line; keeps slices from sharing lines between threads.
+#define CHUNKS_PER_WORKER    8   // Default work-stealing granularity when --chunk isn't given.
+#define DICT_KB             64   // Default --dict-size.
+#define DICT_SAMPLE_SIZE  4096   // Bytes per training sample; the size of the pages the dictionaries are meant for.
+#define DICT_SAMPLE_RATIO  100   // Sample up to this many times the dictionary size.
+#define DICT_SEGMENT      1024   // Dictionary is assembled from segments this long...
+#define DICT_DMER            8   // ...scored by the d-mers (substrings this long) they contain.
+#define DICT_HASH_LOG       20   // d-mer frequency table size.
+#define CACHE_LINE          64   // Stride for clflush and the eviction sweep.
+#define EVICT_LLC_MULTIPLE   2   // --cache evict streams this many times the last-level cache between phases.
+#define EVICT_FALLBACK_MB   32   // LLC size to assume when sysconf() can't tell us.
+uint64_t *BLOCK_SIZES = NULL;    // --block-sizes LIST (or DEFAULT_BLOCK_SIZES).  0 means the whole file as one block.
+int BLOCK_SIZE_COUNT  = 0;
+codec codecs[MAX_CODECS];        // What each cell runs, in order.  Filled from --codecs (or DEFAULT_CODECS).
+int CODEC_COUNT = 0;
+__thread void *codec_states[MAX_CODECS];  // Per worker; whatever each codec's init() returned.
+workspace main_space;            // Buffers for block-parallel cells (and the stream ring); cell-parallel workers get their own.
 int CPU_COUNT = 1;
 int THREADS   = 1;               // Passed as arg 3.  1 == Single Thread.  2+ == Multi-Thread.
+int MMAP_FILES     = 0;          // --mmap: map files and let codecs read the pages in place instead of slurping.
+int POPULATE_FILES = 0;          // --populate: with --mmap, fault the whole mapping in up front (MAP_POPULATE).
+int STREAM_DEPTH   = 0;          // --stream N: pipeline files through a ring of N blocks instead of loading them.
+int *PIN_CPUS      = NULL;       // --cpus LIST: CPU for each worker, in order.  Defaults to the first THREADS we may use.
+int PIN_CPU_COUNT  = 0;
+uint64_t PREFETCH_BUDGET = (uint64_t)PREFETCH_MB << 20;  // --prefetch MB: resident file data the loader may run ahead to.
+int CELL_PARALLEL  = 0;          // --cell-parallel: workers take whole (file, block size) cells instead of sharing one.
+int SYNC_PHASES    = 0;          // --sync-phases: all workers run each phase together, timed once by the wall clock.
+int CHUNK_BLOCKS   = 0;          // --chunk N: blocks per work-stealing chunk.  0 == pick so each worker starts with ~8.
+int PER_THREAD     = 0;          // --per-thread: print each worker's own sizes and times under every row.
+int LATENCY        = 0;          // --latency: time every block on its own and report percentiles per codec/direction.
+int WARMUP_CAP     = WARMUP_SEC; // --warmup-cap SEC: give up waiting for a steady rate after this long.
+double WARMUP_TOLERANCE = 2.0;   // --warmup-tolerance PCT: max spread between the last WARMUP_WINDOWS rates.
+int TRIALS         = 1;          // --trials N: measure each cell N times over the same prepared buffers.
+int MIN_TIME_MS    = 0;          // --min-time MS: keep adding trials until a cell has run at least this long.
+int PREFAULT       = 0;          // --prefault: touch and mlock() every working buffer before any clock starts.
+int REPORT_FAULTS  = 0;          // --faults: print the page faults taken inside each phase.
+int REPORT_CPU     = 0;          // --cpu-time: print CPU-seconds per GB and parallel efficiency for each phase.
+int MLOCK_WARNED   = 0;          // Set by the first worker whose mlock() was refused, so we only say so once.
+int CACHE_MODE     = CACHE_AS_IS; // --cache: as-is, hot (untimed pre-pass), cold (clflush) or evict (LLC sweep).
+const char *cache_names[] = {"as-is", "hot", "cold", "evict"};
+void *evict_buffer = NULL;       // --cache evict: read end to end before every phase to push everything else out.
+uint64_t evict_size = 0;
+int SHUFFLE_CODECS = 0;          // --shuffle-codecs[=SEED]: run the codecs in a fresh random order for every range.
+unsigned SHUFFLE_SEED = 0;       // Defaults to the clock; printed so a run can be repeated.
+int PERF_COUNTERS  = 0;          // --perf: count cycles, instructions, cache/branch/TLB misses around every phase.
+int PERF_AVAILABLE = 1;          // Cleared by the first worker that can't open a counter group.
+int perf_missing[PERF_EVENTS];   // Set for any group member some worker couldn't open.
+__thread int perf_fds[PERF_EVENTS] = {-1, -1, -1, -1, -1, -1};  // Per worker; -1 for events the PMU refused.
+const char *perf_names[PERF_EVENTS] = {"cycles", "instr", "L1D miss", "LLC miss", "br miss", "dTLB miss"};
+int REUSE_CONTEXTS = 0;          // --reuse-contexts: add a context-reusing twin for every lz4/zlib/zstd codec and compare.
+uint64_t DICT_SIZE = (uint64_t)DICT_KB << 10;  // --dict-size: largest dictionary the trainer builds.
+dictionary corpus_dict;          // Trained once from the corpus when a dictionary codec is in the run.
+int SWEEP          = 0;          // --sweep: list each configuration per cell and report Pareto frontiers per block size.
+int OUTPUT_FORMAT  = FORMAT_TABLE; // --format: table for people, csv/json for dashboards.
+FILE *status_out   = NULL;       // Progress chatter; stderr when stdout carries csv/json.
+const char *direction_names[DIRECTIONS] = {"comp", "decomp"};
+worker_pool workers;             // Long-lived, pinned; every timed phase runs on these threads.
 
 
 
@@ -115,36 +385,369 @@ void fatal(int exit_code, char *format, ...) {
 
 
 /*
- *  Validation function for Invocation
+ *  Validation function for Invocation.  Options are consumed first; afterwards optind points at the 2 positional args.
  */
+const char *usage_options =
+  "Options:\n"
+  "  -m, --mmap        Map each file read-only and compress straight from the mapped pages (no slurp, no staging copy).\n"
+  "  -p, --populate    With --mmap, pre-fault the whole mapping (MAP_POPULATE) before testing.\n"
+  "  -s, --stream N    Stream each file through a ring of N blocks (reader -> workers -> sink); memory is bounded by\n"
+  "                    N rather than file size.\n"
+  "  -c, --cpus LIST   Pin worker i to the i-th CPU of LIST, e.g. 0,2,4-7.  Needs at least <thread_count> entries.\n"
+  "  -k, --chunk N     Blocks per work-stealing chunk (default: enough for ~8 chunks per worker, or the whole file with\n"
+  "                    one thread).  Every chunk of one codec finishes before any worker starts the next codec.\n"
+  "  -t, --per-thread  Also print each worker's own row (blocks, sizes, times) beneath the summed row.\n"
+  "  -l, --latency     Time each block individually and print p50/p90/p99/p99.9/max per codec and direction.  The\n"
+  "                    extra clock reads land in the phase totals too.\n"
+  "  -W, --warmup-cap SEC        Stop warming after SEC seconds even if the rate hasn't settled (default 30; 0 skips).\n"
+  "  -T, --warmup-tolerance PCT  Warm-up ends once the last 4 windows are within PCT percent of each other (default 2).\n"
+  "  -n, --trials N    Measure each cell N times over the same buffers; rows show the median and each phase gets\n"
+  "                    median/mean/stddev/min/95% CI after MAD outlier rejection.\n"
+  "  -r, --min-time MS Keep adding trials until the cell has spent at least MS milliseconds (combines with --trials).\n"
+  "  -e, --perf        Read hardware counters (perf_event_open) around each phase on every worker and print them per\n"
+  "                    byte.  Counters the CPU or kernel won't give us are shown as n/a.\n"
+  "  -o, --format FMT  table (default), csv or json (one JSON object per line).  csv/json carry raw nanoseconds and\n"
+  "                    bytes per cell and codec, MB/s, ratio and run metadata; progress goes to stderr instead.\n"
+  "                    The table's notes under each row (latency, perf, trials, workers, cell times, variant deltas)\n"
+  "                    become JSON records of their own type, or \"# type key=value ...\" comment lines in CSV.\n"
+  "  -C, --codecs LIST Codecs to run, in order, each with an optional :level (acceleration for lz4), e.g.\n"
+  "                    memcpy,lz4:8,zstd:1,zstd:19.  Default: " DEFAULT_CODECS ".  lz4-ctx, zlib-ctx and zstd-ctx\n"
+  "                    keep their compression state/contexts/streams per worker and reset them for every block.\n"
+  "                    zlib-win is zlib with the window (and memLevel) shrunk to fit each block; output differs a\n"
+  "                    little from zlib's compress2().\n"
+  "                    zstd-dict, lz4-dict and zlib-dict compress every block against a dictionary trained from the\n"
+  "                    corpus (see -D); lz4-dict uses its last 64 KiB and zlib-dict its last 32 KiB.\n"
+  "  -D, --dict-size SIZE  Dictionary size for the dictionary codecs (*-dict), e.g. 16K (default 64K).  The\n"
+  "                    dictionary is trained once from pieces of every file before testing and reported with its\n"
+  "                    build time; note the measured files are also the training data.\n"
+  "  -F, --prefault    Write-touch every working buffer (and read-touch --mmap files) and mlock() them before any\n"
+  "                    clock starts, so no codec pays first-touch page faults.  If RLIMIT_MEMLOCK is too small the\n"
+  "                    pages are still touched, just not locked.\n"
+  "  -f, --faults      Print the page faults (minor + major, via getrusage) taken inside each codec and direction.\n"
+  "  -U, --cpu-time    Print each phase's thread CPU time as CPU-seconds per (decimal) GB of input, and its parallel\n"
+  "                    efficiency: CPU time over the wall time all workers had for it, i.e. from the first worker\n"
+  "                    starting the phase to the last finishing it, times <thread_count> (times 1 with --cell-parallel,\n"
+  "                    where a cell has one worker).  Both are means over the trials.  Cells cut into several chunks\n"
+  "                    without --sync-phases compress and decompress each chunk back to back, so the directions\n"
+  "                    overlap: they show n/a, plus a \"<codec> both\" line over the codec's whole run.  --stream runs\n"
+  "                    every codec on a block before the next block, so it only shows CPU time.\n"
+  "                    Phases of only a few microseconds can read a little over 100%: the CPU clock is a system\n"
+  "                    call, read just outside the wall clock.\n"
+  "  -H, --cache MODE  What the caches hold when each phase's clock starts.  as-is (default): whatever the previous\n"
+  "                    phase left, so later codecs inherit warm data.  hot: an untimed pass of the same phase runs\n"
+  "                    first.  cold: every line of the phase's buffers is clflush'd (x86 only).  evict: a buffer of\n"
+  "                    twice the last-level cache is streamed through first.  Codec contexts are left alone, and with\n"
+  "                    several threads the others keep running, so cold/evict are only strictly cold single-threaded.\n"
+  "  -z, --shuffle-codecs[=SEED]  Run the codecs in a random order for every range of blocks instead of --codecs order.\n"
+  "                    A range is one trial of a cell, or one block with --stream, and its order depends only on the\n"
+  "                    seed, the file, the block size and the trial/block number, so a seed repeats the orders of a\n"
+  "                    run at any thread count.  The seed defaults to the clock and is printed with the header.\n"
+  "  -R, --reuse-contexts  Pair every lz4, zlib and zstd codec with its -ctx twin at the same level and print the\n"
+  "                    throughput change from reusing contexts, per cell and per block size across all files (in\n"
+  "                    csv/json, delta records; the per-block-size ones have no file).\n"
+  "  -b, --block-sizes LIST  Block sizes to test, e.g. 512,4K,128K-4M,file.  Sizes take K/M/G suffixes (powers of\n"
+  "                    1024), A-B doubles from A up to B, and 'file' compresses each file as a single block.  Minimum\n"
+  "                    512 bytes.  Default: " DEFAULT_BLOCK_SIZES ".\n"
+  "  -P, --prefetch MB Load upcoming files on a background thread while the current one is measured, holding at most\n"
+  "                    MB megabytes of file data (default 1024; 0 loads each file inline between tests, as before).\n"
+  "                    The thread only runs on CPUs no worker is pinned to; without one, files load inline anyway.\n"
+  "  -S, --sweep       Add every zstd level, zlib 1-9 and lz4 accelerations 1-64 to the codecs.  Each cell lists one\n"
+  "                    line per configuration (* marks its Pareto frontier) and the run ends with the frontier of\n"
+  "                    ratio vs compress MB/s vs decompress MB/s for each block size, across all files.\n"
+  "  -X, --cell-parallel  Run whole (file, block size) cells concurrently, one per worker, instead of splitting each\n"
+  "                    cell's blocks across all workers.  Suits corpora of many small files.  Each worker gets its own\n"
+  "                    buffers, so memory grows with <thread_count>.  Rows still print in order, each with the cell's\n"
+  "                    own wall and CPU time.\n"
+  "  -Y, --sync-phases Split each cell's blocks evenly and have every worker run the same phase at the same time,\n"
+  "                    with a barrier before and after each.  Each phase is timed once, barrier to barrier, so MB/s is\n"
+  "                    what all <thread_count> workers sustain together on one codec.\n";
+void parse_cpu_list(char *list) {
+  // Accepts comma separated CPUs and inclusive ranges.  Duplicates are allowed, if odd.
+  char *token = NULL, *save = NULL, *end = NULL, *dash = NULL;
+  long first = 0, last = 0;
+  list = strdup(list);
+  for(token = strtok_r(list, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+    first = strtol(token, &end, 10);
+    last = first;
+    if(end != token && *end == '-') {
+      dash = end + 1;
+      last = strtol(dash, &end, 10);
+      if(end == dash)
+        end = token;
+    }
+    if(end == token || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+      fatal(E_GENERIC, "%s%s", "Bad CPU or CPU range in --cpus: ", token);
+    for(int cpu=first; cpu<=last; cpu++) {
+      PIN_CPUS = realloc(PIN_CPUS, (PIN_CPU_COUNT + 1) * sizeof(int));
+      PIN_CPUS[PIN_CPU_COUNT++] = cpu;
+    }
+  }
+  free(list);
+}
+unsigned parse_seed(char *text) {
+  // A plain decimal that fits the seed; strtoul() would quietly turn junk into 0 and a leading '-' into a huge value.
+  char *end = NULL;
+  unsigned long seed = 0;
+  errno = 0;
+  seed = strtoul(text, &end, 10);
+  if(end == text || *end != '\0' || errno != 0 || text[0] == '-' || seed != (unsigned)seed)
+    fatal(E_GENERIC, "%s%s", "Bad seed in --shuffle-codecs: ", text);
+  return seed;
+}
+uint64_t parse_bytes(char *text, uint64_t minimum, char *what) {
+  // A byte count with an optional binary K/M/G suffix.
+  char *end = NULL;
+  uint64_t size = strtoull(text, &end, 10);
+  switch(*end) {
+    case 'K': case 'k': size <<= 10; end++; break;
+    case 'M': case 'm': size <<= 20; end++; break;
+    case 'G': case 'g': size <<= 30; end++; break;
+  }
+  if(end == text || *end != '\0' || size < minimum)
+    fatal(E_GENERIC, "%s%s%lu%s%s", what, " at least ", minimum, " bytes, not: ", text);
+  return size;
+}
+uint64_t parse_size(char *text) {
+  // "file" for whole-file, otherwise a byte count.
+  if(strcmp(text, "file") == 0)
+    return 0;
+  return parse_bytes(text, MIN_BLOCK_SIZE, "Block sizes must be 'file' or");
+}
+void parse_block_sizes(char *list) {
+  // Accepts comma separated sizes and doubling ranges, in the order they're given.
+  char *token = NULL, *save = NULL, *dash = NULL;
+  uint64_t first = 0, last = 0;
+  list = strdup(list);
+  for(token = strtok_r(list, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+    dash = strchr(token, '-');
+    if(dash != NULL)
+      *dash = '\0';
+    first = parse_size(token);
+    last = dash != NULL ? parse_size(dash + 1) : first;
+    if(dash != NULL && (first == 0 || last < first))
+      fatal(E_GENERIC, "%s%s%s%s", "Bad block size range in --block-sizes: ", token, "-", dash + 1);
+    for(uint64_t size=first; size<=last; size*=2) {
+      BLOCK_SIZES = realloc(BLOCK_SIZES, (BLOCK_SIZE_COUNT + 1) * sizeof(uint64_t));
+      BLOCK_SIZES[BLOCK_SIZE_COUNT++] = size;
+      if(size == 0)
+        break;
+    }
+  }
+  free(list);
+}
+const struct option long_options[] = {
+  {"mmap",     no_argument,       NULL, 'm'},
+  {"populate", no_argument,       NULL, 'p'},
+  {"stream",   required_argument, NULL, 's'},
+  {"cpus",     required_argument, NULL, 'c'},
+  {"chunk",    required_argument, NULL, 'k'},
+  {"per-thread", no_argument,     NULL, 't'},
+  {"latency",  no_argument,       NULL, 'l'},
+  {"warmup-cap",       required_argument, NULL, 'W'},
+  {"warmup-tolerance", required_argument, NULL, 'T'},
+  {"trials",   required_argument, NULL, 'n'},
+  {"min-time", required_argument, NULL, 'r'},
+  {"perf",     no_argument,       NULL, 'e'},
+  {"format",   required_argument, NULL, 'o'},
+  {"codecs",   required_argument, NULL, 'C'},
+  {"sweep",    no_argument,       NULL, 'S'},
+  {"block-sizes", required_argument, NULL, 'b'},
+  {"prefetch", required_argument, NULL, 'P'},
+  {"cell-parallel", no_argument,  NULL, 'X'},
+  {"sync-phases", no_argument,    NULL, 'Y'},
+  {"reuse-contexts", no_argument, NULL, 'R'},
+  {"dict-size", required_argument, NULL, 'D'},
+  {"prefault", no_argument,       NULL, 'F'},
+  {"faults",   no_argument,       NULL, 'f'},
+  {"cpu-time", no_argument,       NULL, 'U'},
+  {"cache",    required_argument, NULL, 'H'},
+  {"shuffle-codecs", optional_argument, NULL, 'z'},
+  {NULL,       0,                 NULL,  0 }
+};
+void parse_codec_list(char *list);
+void add_sweep_codecs();
+void add_context_twins();
 void validate(int argc, char **argv) {
+  int opt = 0;
   if(argc == 1)
-    fatal(E_GENERIC, "%s%s%s", "Usage: ", argv[0], " /path/to/data/folder <thread_count>");
-  if(argc != 3)
+    fatal(E_GENERIC, "%s%s%s\n%s", "Usage: ", argv[0], " [options] /path/to/data/folder <thread_count>", usage_options);
+  while((opt = getopt_long(argc, argv, "mps:c:k:tlW:T:n:r:eo:C:Sb:P:XYRD:FfUH:z::", long_options, NULL)) != -1) {
+    switch(opt) {
+      case 'm': MMAP_FILES = 1;             break;
+      case 'p': POPULATE_FILES = 1;         break;
+      case 's':
+        STREAM_DEPTH = atoi(optarg);
+        if(STREAM_DEPTH < 1)
+          fatal(E_GENERIC, "%s%s", "The --stream ring depth must be a positive number of blocks, not: ", optarg);
+        break;
+      case 'c': parse_cpu_list(optarg);     break;
+      case 't': PER_THREAD = 1;             break;
+      case 'l': LATENCY = 1;                break;
+      case 'e': PERF_COUNTERS = 1;          break;
+      case 'C': parse_codec_list(optarg);   break;
+      case 'S': SWEEP = 1; add_sweep_codecs(); break;
+      case 'b': parse_block_sizes(optarg);  break;
+      case 'X': CELL_PARALLEL = 1;          break;
+      case 'Y': SYNC_PHASES = 1;            break;
+      case 'R': REUSE_CONTEXTS = 1;         break;
+      case 'F': PREFAULT = 1;               break;
+      case 'f': REPORT_FAULTS = 1;          break;
+      case 'U': REPORT_CPU = 1;             break;
+      case 'H':
+        for(CACHE_MODE=CACHE_EVICT; CACHE_MODE>=0 && strcmp(optarg, cache_names[CACHE_MODE]) != 0; CACHE_MODE--);
+        if(CACHE_MODE < 0)
+          fatal(E_GENERIC, "%s%s", "The --cache mode must be as-is, hot, cold or evict, not: ", optarg);
+#if !defined(__x86_64__) && !defined(__i386__)
+        if(CACHE_MODE == CACHE_COLD)
+          fatal(E_GENERIC, "%s", "--cache cold needs clflush (x86); use --cache evict on this platform.");
+#endif
+        break;
+      case 'z':
+        SHUFFLE_CODECS = 1;
+        SHUFFLE_SEED = optarg != NULL ? parse_seed(optarg) : (unsigned)time(NULL);
+        break;
+      case 'D':
+        DICT_SIZE = parse_bytes(optarg, DICT_SEGMENT, "The --dict-size must be");
+        break;
+      case 'o':
+        if(strcmp(optarg, "table") == 0)
+          OUTPUT_FORMAT = FORMAT_TABLE;
+        else if(strcmp(optarg, "csv") == 0)
+          OUTPUT_FORMAT = FORMAT_CSV;
+        else if(strcmp(optarg, "json") == 0)
+          OUTPUT_FORMAT = FORMAT_JSON;
+        else
+          fatal(E_GENERIC, "%s%s", "The --format must be table, csv or json, not: ", optarg);
+        break;
+      case 'W':
+        WARMUP_CAP = atoi(optarg);
+        if(WARMUP_CAP < 0)
+          fatal(E_GENERIC, "%s%s", "The --warmup-cap must be zero or a positive number of seconds, not: ", optarg);
+        break;
+      case 'T':
+        WARMUP_TOLERANCE = atof(optarg);
+        if(WARMUP_TOLERANCE <= 0)
+          fatal(E_GENERIC, "%s%s", "The --warmup-tolerance must be a positive percentage, not: ", optarg);
+        break;
+      case 'n':
+        TRIALS = atoi(optarg);
+        if(TRIALS < 1 || TRIALS > MAX_TRIALS)
+          fatal(E_GENERIC, "%s%i%s%s", "The --trials count must be between 1 and ", MAX_TRIALS, ", not: ", optarg);
+        break;
+      case 'r':
+        MIN_TIME_MS = atoi(optarg);
+        if(MIN_TIME_MS < 1)
+          fatal(E_GENERIC, "%s%s", "The --min-time must be a positive number of milliseconds, not: ", optarg);
+        break;
+      case 'P':
+        if(atoi(optarg) < 0)
+          fatal(E_GENERIC, "%s%s", "The --prefetch budget must be zero or a positive number of megabytes, not: ", optarg);
+        PREFETCH_BUDGET = (uint64_t)atoi(optarg) << 20;
+        break;
+      case 'k':
+        CHUNK_BLOCKS = atoi(optarg);
+        if(CHUNK_BLOCKS < 1)
+          fatal(E_GENERIC, "%s%s", "The --chunk size must be a positive number of blocks, not: ", optarg);
+        break;
+      default:  fatal(E_GENERIC, "%s\n%s", "Unrecognized option.", usage_options);
+    }
+  }
+  if(CODEC_COUNT == 0)
+    parse_codec_list(DEFAULT_CODECS);
+  if(REUSE_CONTEXTS)
+    add_context_twins();
+  if(BLOCK_SIZE_COUNT == 0)
+    parse_block_sizes(DEFAULT_BLOCK_SIZES);
+  if(POPULATE_FILES && !MMAP_FILES)
+    fatal(E_GENERIC, "%s", "The --populate option only makes sense with --mmap.");
+  if(STREAM_DEPTH > 0 && MMAP_FILES)
+    fatal(E_GENERIC, "%s", "The --stream and --mmap options are mutually exclusive.");
+  if(STREAM_DEPTH > 0 && (TRIALS > 1 || MIN_TIME_MS > 0))
+    fatal(E_GENERIC, "%s", "Trials reuse resident buffers, so --trials and --min-time can't be combined with --stream.");
+  if(STREAM_DEPTH > 0 && CELL_PARALLEL)
+    fatal(E_GENERIC, "%s", "The --stream and --cell-parallel options are mutually exclusive.");
+  if(SYNC_PHASES && (STREAM_DEPTH > 0 || CELL_PARALLEL))
+    fatal(E_GENERIC, "%s", "The --sync-phases option splits one resident cell, so it can't be combined with --stream or --cell-parallel.");
+  if(PER_THREAD && CELL_PARALLEL)
+    fatal(E_GENERIC, "%s", "Each cell runs on a single worker with --cell-parallel, so --per-thread has nothing to add.");
+  if(argc - optind != 2)
     fatal(E_GENERIC, "%s", "You must send exactly 2 arguments to this program: the full path to the files to work with and thread count.");
-  if(strlen(argv[1]) == 0 || strncmp(argv[1], "/", 1) != 0)
-    fatal(E_GENERIC, "%s", "You must send a valid path to scan for files (non-recursive).  It should start with: /something");
+  argv += optind;
+  if(strlen(argv[0]) == 0 || strncmp(argv[0], "/", 1) != 0)
+    fatal(E_GENERIC, "%s", "You must send a valid path to scan for files (recursively).  It should start with: /something");
   // Directory Checking
-  DIR *dir = opendir(argv[1]);
+  DIR *dir = opendir(argv[0]);
   if(!dir)
-    fatal(E_IO, "%s%s", "Can't open directory: bad path, isn't a directory, missing permission, etc.: ", argv[1]);
+    fatal(E_IO, "%s%s", "Can't open directory: bad path, isn't a directory, missing permission, etc.: ", argv[0]);
   closedir(dir);
-  if(atoi(argv[2]) < 1)
-    fatal(E_GENERIC, "%s%i", "The second argument must be a positive number for thread count not: ", atoi(argv[2]));
-  if(atoi(argv[2]) > CPU_COUNT)
+  if(atoi(argv[1]) < 1)
+    fatal(E_GENERIC, "%s%i", "The second argument must be a positive number for thread count not: ", atoi(argv[1]));
+  if(atoi(argv[1]) > CPU_COUNT)
     fatal(E_GENERIC, "%s", "You can't specify more threads than there are CPUs/Cores to handle them.");
+  if(PIN_CPU_COUNT > 0 && PIN_CPU_COUNT < atoi(argv[1]))
+    fatal(E_GENERIC, "%s%i%s", "The --cpus list names fewer CPUs than the ", atoi(argv[1]), " threads requested.");
   return;
 }
 
 
 
 /*
- *  Scan for files in the specified directory.  Caller must provide initial validation.  We fatal if no files found.
+ *  Scan for files under the specified directory, recursively.  Caller must provide initial validation.  We fatal if no
+ *  files found.  Files come back sorted by path so two runs over the same corpus list their cells in the same order.
  */
-void scan_files(char *path, src_file files[], int *file_count) {
+void scan_directory(char *path, src_file **files, int *file_count, int *capacity) {
+  // path always ends in a slash.
   DIR *dir = opendir(path);
   struct dirent *entry;
+  struct stat info;
+  char *child = NULL;
+  int is_file = 0, is_dir = 0, is_link = 0;
+  if(!dir)
+    fatal(E_IO, "%s%s", "scan_files failed to open directory: ", path);
+  for(entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+    strcpy(child, path);
+    strcat(child, entry->d_name);
+    is_file = entry->d_type == DT_REG;
+    is_dir = entry->d_type == DT_DIR;
+    is_link = entry->d_type == DT_LNK;
+    if(entry->d_type == DT_UNKNOWN && lstat(child, &info) == 0) {
+      // Some filesystems don't fill in d_type.
+      is_file = S_ISREG(info.st_mode);
+      is_dir = S_ISDIR(info.st_mode);
+      is_link = S_ISLNK(info.st_mode);
+    }
+    if(is_link && stat(child, &info) == 0)
+      is_file = S_ISREG(info.st_mode);  // Links to files count; linked directories aren't followed, so no loops.
+    if(is_dir) {
+      strcat(child, "/");
+      scan_directory(child, files, file_count, capacity);
+      free(child);
+      continue;
+    }
+    if(!is_file) {
+      free(child);
+      continue;
+    }
+    if(*file_count == *capacity) {
+      *capacity = *capacity > 0 ? *capacity * 2 : 64;
+      *files = realloc(*files, *capacity * sizeof(src_file));
+      if(*files == NULL)
+        fatal(E_GENERIC, "%s", "Failed to grow the file list.");
+    }
+    (*files)[(*file_count)++].filespec = child;
+  }
+  closedir(dir);
+}
+int compare_files(const void *a, const void *b) {
+  return strcmp(((src_file *)a)->filespec, ((src_file *)b)->filespec);
+}
+void stat_file(src_file *src);
+void scan_files(char *path, src_file **files, int *file_count) {
   FILE *fh = NULL;
+  int capacity = 0, kept = 0;
 
   // For simplicity we'll put a trailing slash on path.
   if(strcmp(path + strlen(path) - 1, "/") != 0) {
@@ -154,32 +757,28 @@ void scan_files(char *path, src_file files[], int *file_count) {
     path = new_path;
   }
 
-  // Scan (non-recursively)
-  if(!dir)
-    fatal(E_IO, "%s%s", "scan_files failed to open directory: ", path);
-  entry = readdir(dir);
-  while(entry != NULL) {
-    if(entry->d_type == DT_REG) {
-      if(*file_count + 1 >= MAX_FILES)
-	fatal(E_GENERIC, "You can only read up to %d files.", MAX_FILES);
-      files[(*file_count)].filespec = malloc(strlen(path) + strlen(entry->d_name) + 1);
-      strcpy(files[(*file_count)].filespec, path);
-      strcat(files[(*file_count)].filespec, entry->d_name);
-      (*file_count)++;
-    }
-    entry = readdir(dir);
-  }
-  closedir(dir);
+  // Scan (recursively)
+  *files = NULL;
+  *file_count = 0;
+  scan_directory(path, files, file_count, &capacity);
+  qsort(*files, *file_count, sizeof(src_file), &compare_files);
 
-  // Make sure we found at least 1 file, and we have rights to read each file.
-  if(*file_count < 1)
-    fatal(E_IO, "%s", "Unable to find any files :(");
+  // Make sure we have rights to read each file, and note its length.  Empty files have no blocks to test, so drop them.
   for(int i=0; i<(*file_count); i++) {
-    fh = fopen(files[i].filespec, "rb");
+    fh = fopen((*files)[i].filespec, "rb");
     if(fh == NULL)
-      fatal(E_IO, "%s%s", "Unable to open file for binary reading: ", files[i].filespec);
+      fatal(E_IO, "%s%s", "Unable to open file for binary reading: ", (*files)[i].filespec);
     fclose(fh);
+    stat_file(&(*files)[i]);
+    (*files)[i].name = (*files)[i].filespec + strlen(path);
+    if((*files)[i].size > 0)
+      (*files)[kept++] = (*files)[i];
+    else
+      free((*files)[i].filespec);
   }
+  *file_count = kept;
+  if(*file_count < 1)
+    fatal(E_IO, "%s", "Unable to find any (non-empty) files :(");
 }
 
 
@@ -205,14 +804,53 @@ void slurp_file(src_file *src) {
     fatal(E_IO, "%s", "Failed to read a file into memory while slurping.");
 
   fclose(fh);
+  src->mapped = 0;
 
   // All done.
   return;
 }
+void map_file(src_file *src) {
+  // Zero-copy alternative to slurp_file(): the page cache backs *data and blocks are read from it in place.
+  struct stat info;
+  int flags = MAP_PRIVATE;
+  int fd = open(src->filespec, O_RDONLY);
+  if(fd == -1)
+    fatal(E_IO, "%s%s", "Unable to open file for mapping: ", src->filespec);
+  if(fstat(fd, &info) != 0)
+    fatal(E_IO, "%s%s", "Unable to stat file for mapping: ", src->filespec);
+  if(info.st_size == 0)
+    fatal(E_IO, "%s%s", "Refusing to map an empty file: ", src->filespec);
+  src->size = info.st_size;
+  if(POPULATE_FILES)
+    flags |= MAP_POPULATE;
+  src->data = mmap(NULL, src->size, PROT_READ, flags, fd, 0);
+  if(src->data == MAP_FAILED) {
+    src->data = NULL;
+    fatal(E_IO, "%s%s", "Failed to mmap file: ", src->filespec);
+  }
+  close(fd);
+
+  // Every block size walks the file front to back, so tell the kernel to read ahead aggressively.  Hints only.
+  madvise(src->data, src->size, MADV_SEQUENTIAL);
+  madvise(src->data, src->size, MADV_WILLNEED);
+  src->mapped = 1;
+}
+void stat_file(src_file *src) {
+  // Streaming never loads the file, it only needs the length up front to size the cell.
+  struct stat info;
+  if(stat(src->filespec, &info) != 0)
+    fatal(E_IO, "%s%s", "Unable to stat file: ", src->filespec);
+  src->size = info.st_size;
+  src->data = NULL;
+  src->mapped = 0;
+}
 void unslurp_file(src_file *src) {
-  // For now all I think we need to do is free the *data.  The rest is trivial.
+  // For now all I think we need to do is release the *data.  The rest is trivial.
   if(src->data) {
-    free(src->data);
+    if(src->mapped)
+      munmap(src->data, src->size);
+    else
+      free(src->data);
     src->data = NULL;
   }
 }
@@ -220,293 +858,2842 @@ void unslurp_file(src_file *src) {
 
 
 /*
- *  Print a table entry, header, or etc.
+ *  Background prefetch.  A loader thread slurps (or maps) files in order while earlier ones are being measured, so file
+ *  I/O no longer sits between cells.  It stays within PREFETCH_BUDGET bytes of resident file data, except that a file
+ *  is always allowed to load when nothing else is resident (one file bigger than the budget still runs).  The loader
+ *  never shares a CPU with a worker: when every CPU we may use is pinned to one, files load inline between cells.
  */
-const int fields[16] = {16, 10, 10, 6, 6, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8};
-char *hyphens = "----------------------------------------------------------------------------------------------------";
-char *blank = "                                                                                                  ";
-int to_kib(uint64_t value) {
-  return (int)(value / 1024);
+void load_file(src_file *src) {
+  if(MMAP_FILES)
+    map_file(src);
+  else
+    slurp_file(src);
 }
-int ns_to_ms(uint64_t value) {
-  return (int)(value / MILLION);
+int spare_cpus(cpu_set_t *spare) {
+  // The CPUs we're allowed on that no worker is pinned to.
+  CPU_ZERO(spare);
+  sched_getaffinity(0, sizeof(*spare), spare);
+  for(int i=0; i<THREADS; i++)
+    CPU_CLR(PIN_CPUS[i], spare);
+  return CPU_COUNT_S(sizeof(*spare), spare);
 }
-int ns_to_us(uint64_t value) {
-  return (int)(value / THOUSAND);
+void prefetch_loader(prefetcher *pf) {
+  pthread_setaffinity_np(pthread_self(), sizeof(pf->spare), &pf->spare);
+  for(int i=0; i<pf->file_count; i++) {
+    pthread_mutex_lock(&pf->lock);
+    while(!pf->stop && pf->resident > 0 && pf->resident + pf->files[i].size > pf->budget)
+      pthread_cond_wait(&pf->changed, &pf->lock);
+    if(pf->stop) {
+      pthread_mutex_unlock(&pf->lock);
+      break;
+    }
+    pf->reserved[i] = pf->files[i].size;
+    pf->resident += pf->reserved[i];
+    pthread_mutex_unlock(&pf->lock);
+    load_file(&pf->files[i]);
+    pthread_mutex_lock(&pf->lock);
+    pf->loaded = i + 1;
+    pthread_cond_broadcast(&pf->changed);
+    pthread_mutex_unlock(&pf->lock);
+  }
 }
-void print_separator(char *column, char *fill) {
-  // Note: we +2 to complement padding of strings/values.
-  printf("%1s%*.*s%1s%*.*s%1s%*.*s%1s%*.*s%1s%*.*s%1s%*.*s%1s%*.*s%1s\n",
-    column, fields[0] + 2, fields[0] + 2, fill,
-    column, fields[1] + 2, fields[1] + 2, fill,
-    column, fields[2] + 2, fields[2] + 2, fill,
-    column, fields[3] + 2, fields[3] + 2, fill,
-    column, fields[4] + fields[5] + fields[6] + fields[7] + 2, fields[4] + fields[5] + fields[6] + fields[7] + 2, fill,
-    column, fields[8] + fields[9] + fields[10] + fields[11] + 2, fields[8] + fields[9] + fields[10] + fields[11] + 2, fill,
-    column, fields[12] + fields[13] + fields[14] + fields[15] + 2, fields[12] + fields[13] + fields[14] + fields[15] + 2, fill,
-    column
-  );
+void prefetch_start(prefetcher *pf, src_file *files, int file_count) {
+  pf->files = files;
+  pf->file_count = file_count;
+  pf->loaded = 0;
+  pf->resident = 0;
+  pf->budget = PREFETCH_BUDGET;
+  pf->stop = 0;
+  pf->reserved = calloc(file_count > 0 ? file_count : 1, sizeof(uint64_t));
+  if(pf->reserved == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the prefetch reservations.");
+  if(pf->budget > 0 && file_count > 0 && spare_cpus(&pf->spare) == 0) {
+    fprintf(status_out, "Note: every CPU is pinned to a worker, so files load between cells instead of in the background.\n");
+    pf->budget = 0;
+  }
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->changed, NULL);
+  if(pf->budget > 0)
+    pthread_create(&pf->thread, NULL, (void *) &prefetch_loader, pf);
 }
-void print_header() {
-  printf("Threading Mode: %s", THREADS > 1 ? "Multi-Threaded" : "Single-Threaded");
-  if(THREADS > 1)
-    printf("  (%i threads)", THREADS);
-  printf("\n");
-  print_separator("+", hyphens);
-  printf("| %-*.*s | %*.*s | %*.*s | %*.*s | %-*.*s | %-*.*s | %-*.*s |\n",
-    fields[0], fields[0], "Data File",
-    fields[1], fields[1], "Size (KiB)",
-    fields[2], fields[2], "Block Size",
-    fields[3], fields[3], "Blocks",
-    fields[4] + fields[5] + fields[6] + fields[7], fields[4] + fields[5] + fields[6] + fields[7], "Compression Size (KiB)",
-    fields[8] + fields[9] + fields[10] + fields[11], fields[8] + fields[9] + fields[10] + fields[11], "Compression Time (uS)",
-    fields[12] + fields[13] + fields[14] + fields[15], fields[12] + fields[13] + fields[14] + fields[15], "Decompression Time (uS)"
-  );
-  printf("| %*.*s | %*.*s | %*.*s | %*.*s | %*.*s%*.*s%*.*s%*.*s | %*.*s%*.*s%*.*s%*.*s | %*.*s%*.*s%*.*s%*.*s |\n",
-    fields[0], fields[0], blank,
-    fields[1], fields[1], "(2^10)",
-    fields[2], fields[2], blank,
-    fields[3], fields[3], blank,
-    fields[4], fields[4], "Memcpy",
-    fields[5], fields[5], "LZ4",
-    fields[6], fields[6], "ZLIB",
-    fields[7], fields[7], "ZSTD",
-    fields[8], fields[8], "Memcpy",
-    fields[9], fields[9], "LZ4",
-    fields[10], fields[10], "ZLIB",
-    fields[11], fields[11], "ZSTD",
-    fields[12], fields[12], "Memcpy",
-    fields[13], fields[13], "LZ4",
-    fields[14], fields[14], "ZLIB",
-    fields[15], fields[15], "ZSTD"
-  );
-  print_separator("+", hyphens);
+void prefetch_wait(prefetcher *pf, int index) {
+  // Without a budget there's no loader; load inline like we always used to.  Several cells of one file may ask at once
+  // with --cell-parallel, so the first caller loads it (and any it skipped) under the lock and the rest just wait.
+  pthread_mutex_lock(&pf->lock);
+  for(; pf->budget == 0 && pf->loaded <= index; pf->loaded++) {
+    pf->reserved[pf->loaded] = pf->files[pf->loaded].size;
+    pf->resident += pf->reserved[pf->loaded];
+    load_file(&pf->files[pf->loaded]);
+  }
+  while(pf->loaded <= index)
+    pthread_cond_wait(&pf->changed, &pf->lock);
+  pthread_mutex_unlock(&pf->lock);
 }
-void print_result(result *res) {
-  printf("| %-*.*s | %*i | %*i | %*i | %*i%*i%*i%*i | %*i%*i%*i%*i | %*i%*i%*i%*i |\n",
-    fields[0], fields[0], basename(res->src->filespec),
-    fields[1], to_kib(res->src->size),
-    fields[2], res->block_size,
-    fields[3], res->blocks,
-    fields[4], to_kib(res->src->size),
-    fields[5], to_kib(res->lz4_comp_size),
-    fields[6], to_kib(res->zlib_comp_size),
-    fields[7], to_kib(res->zstd_comp_size),
-    fields[8], ns_to_us(res->memcpy_time),
-    fields[9], ns_to_us(res->lz4_comp_time),
-    fields[10], ns_to_us(res->zlib_comp_time),
-    fields[11], ns_to_us(res->zstd_comp_time),
-    fields[12], ns_to_us(res->memcpy_time),
-    fields[13], ns_to_us(res->lz4_decomp_time),
-    fields[14], ns_to_us(res->zlib_decomp_time),
-    fields[15], ns_to_us(res->zstd_decomp_time)
-  );
+void prefetch_release(prefetcher *pf, int index) {
+  unslurp_file(&pf->files[index]);
+  pthread_mutex_lock(&pf->lock);
+  pf->resident -= pf->reserved[index];
+  pf->reserved[index] = 0;
+  pthread_cond_broadcast(&pf->changed);
+  pthread_mutex_unlock(&pf->lock);
+}
+void prefetch_stop(prefetcher *pf) {
+  pthread_mutex_lock(&pf->lock);
+  pf->stop = 1;
+  pthread_cond_broadcast(&pf->changed);
+  pthread_mutex_unlock(&pf->lock);
+  if(pf->budget > 0)
+    pthread_join(pf->thread, NULL);
+  pthread_mutex_destroy(&pf->lock);
+  pthread_cond_destroy(&pf->changed);
+  free(pf->reserved);
 }
 
 
 
 /*
- *  Compression test on a slurped file with a given block size.
+ *  Dictionary training.  The vendored zstd has no zdict, so this is a cut-down COVER: sample pieces spread evenly over
+ *  every file, count how often each d-mer turns up, then split the samples into one epoch per dictionary segment and
+ *  keep each epoch's highest-scoring segment (a segment scores the frequencies of the distinct d-mers in it).  Chosen
+ *  d-mers stop scoring, and segments are laid out by score so the best material sits at the end, closest to the data.
+ *  The result is a raw-content dictionary, so zstd, LZ4 and zlib can all use it as-is.
  */
-void increment_result_value(result *res, uint64_t *item, uint64_t value) {
-  pthread_mutex_lock(&res->lock);
-  *item += value;
-  pthread_mutex_unlock(&res->lock);
+void read_block(int fd, void *dest, uint64_t size, uint64_t offset, char *filespec);
+static inline uint32_t dmer_hash(const unsigned char *data) {
+  uint64_t value = 0;
+  memcpy(&value, data, DICT_DMER);
+  return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> (64 - DICT_HASH_LOG));
+}
+uint64_t sample_corpus(src_file *files, int file_count, unsigned char **samples) {
+  // Each file gets a share of the sample budget proportional to its size, read as DICT_SAMPLE_SIZE pieces evenly spaced
+  // through it (small files are taken whole).
+  uint64_t total = 0, budget = 0, used = 0, pieces = 0, piece = 0, spacing = 0;
+  int fd = -1;
+  for(int i=0; i<file_count; i++)
+    total += files[i].size;
+  budget = DICT_SIZE * DICT_SAMPLE_RATIO < total ? DICT_SIZE * DICT_SAMPLE_RATIO : total;
+  *samples = malloc(budget + (uint64_t)file_count * DICT_SAMPLE_SIZE);
+  if(*samples == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate dictionary samples.");
+  for(int i=0; i<file_count; i++) {
+    piece = files[i].size < DICT_SAMPLE_SIZE ? files[i].size : DICT_SAMPLE_SIZE;
+    pieces = (uint64_t)((double)budget * files[i].size / total) / DICT_SAMPLE_SIZE;
+    if(pieces < 1)
+      pieces = 1;
+    if(pieces > files[i].size / piece)
+      pieces = files[i].size / piece;
+    spacing = pieces > 1 ? (files[i].size - piece) / (pieces - 1) : 0;
+    fd = open(files[i].filespec, O_RDONLY);
+    if(fd == -1)
+      fatal(E_IO, "%s%s", "Unable to open file for dictionary samples: ", files[i].filespec);
+    for(uint64_t p=0; p<pieces; p++) {
+      read_block(fd, *samples + used, piece, p * spacing, files[i].filespec);
+      used += piece;
+    }
+    close(fd);
+    corpus_dict.samples += pieces;
+  }
+  return used;
+}
+uint64_t best_segment(unsigned char *data, uint64_t begin, uint64_t end, uint32_t *freq, uint16_t *active,
+                      uint64_t *best_score) {
+  // Slide a DICT_SEGMENT window over [begin, end) and return the start of the one whose distinct d-mers score highest.
+  uint64_t dmers = DICT_SEGMENT - DICT_DMER + 1;
+  uint64_t score = 0, best = 0, best_start = begin;
+  for(uint64_t j=begin; j+DICT_DMER<=end; j++) {
+    uint32_t hash = dmer_hash(data + j);
+    if(active[hash]++ == 0)
+      score += freq[hash];
+    if(j - begin >= dmers) {
+      hash = dmer_hash(data + j - dmers);
+      if(--active[hash] == 0)
+        score -= freq[hash];
+    }
+    if(j - begin + 1 >= dmers && score > best) {
+      best = score;
+      best_start = j + 1 - dmers;
+    }
+  }
+  // Leave the active counts clean for the next epoch: the last window's d-mers start at end - DICT_SEGMENT.
+  for(uint64_t j=(end - begin >= DICT_SEGMENT ? end - DICT_SEGMENT : begin); j+DICT_DMER<=end; j++)
+    active[dmer_hash(data + j)] = 0;
+  *best_score = best;
+  return best > 0 ? best_start : end;
+}
+int compare_segments(const void *a, const void *b) {
+  uint64_t left = ((const dict_segment *)a)->score, right = ((const dict_segment *)b)->score;
+  return (left > right) - (left < right);
 }
-void run_test(result *res, src_file *src, int block_size, int s_idx, int e_idx) {
+void train_dictionary(src_file *files, int file_count) {
   struct timespec start, end;
-  int zlib_errors = 0;
-  uint64_t tmp_size = 0;
-
-  // -- Memcpy
+  unsigned char *samples = NULL, *content = NULL;
+  uint32_t *freq = NULL;
+  uint16_t *active = NULL;
+  dict_segment *segments = NULL;
+  uint64_t sampled = 0, epoch_size = 0, filled = 0, chosen = 0, score = 0, segment = 0;
   clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++)
-    memcpy(bufs[i].raw, src->data + (i * block_size), bufs[i].raw_size);
+  sampled = sample_corpus(files, file_count, &samples);
+  corpus_dict.sample_bytes = sampled;
+  content = malloc(DICT_SIZE);
+  freq = calloc((size_t)1 << DICT_HASH_LOG, sizeof(uint32_t));
+  active = calloc((size_t)1 << DICT_HASH_LOG, sizeof(uint16_t));
+  segments = malloc(DICT_SIZE / DICT_SEGMENT * sizeof(dict_segment));
+  if(content == NULL || freq == NULL || active == NULL || segments == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the dictionary trainer.");
+  if(sampled <= DICT_SIZE) {
+    // Not enough to choose from; the samples are the dictionary.
+    memcpy(content, samples, sampled);
+    filled = sampled;
+  } else {
+    for(uint64_t j=0; j+DICT_DMER<=sampled; j++)
+      freq[dmer_hash(samples + j)]++;
+    epoch_size = sampled / (DICT_SIZE / DICT_SEGMENT);
+    if(epoch_size < DICT_SEGMENT)
+      epoch_size = DICT_SEGMENT;
+    for(uint64_t begin=0; begin+DICT_SEGMENT<=sampled && chosen<DICT_SIZE/DICT_SEGMENT; begin+=epoch_size) {
+      uint64_t stop = begin + epoch_size < sampled ? begin + epoch_size : sampled;
+      segment = best_segment(samples, begin, stop, freq, active, &score);
+      if(segment == stop)
+        continue;
+      segments[chosen].start = segment;
+      segments[chosen++].score = score;
+      for(uint64_t j=segment; j+DICT_DMER<=segment+DICT_SEGMENT; j++)
+        freq[dmer_hash(samples + j)] = 0;
+    }
+    // Weakest first, strongest last: the end of the dictionary is nearest every block, and the only part LZ4's small
+    // hash table is sure to still remember.
+    qsort(segments, chosen, sizeof(dict_segment), &compare_segments);
+    for(uint64_t i=0; i<chosen; i++, filled+=DICT_SEGMENT)
+      memcpy(content + filled, samples + segments[i].start, DICT_SEGMENT);
+  }
+  corpus_dict.size = filled;
+  corpus_dict.content = content;
+  free(segments);
+  free(freq);
+  free(active);
+  free(samples);
   clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->memcpy_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
+  corpus_dict.build_time = BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+}
 
-  // Run the tests.  To reduce the effects of caching-warming we use one compressor at a time.
-  // -- LZ4
-  // Compress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++)
-    bufs[i].comp_size = LZ4_compress_default(bufs[i].raw, bufs[i].compressed, bufs[i].raw_size, bufs[i].raw_size);
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->lz4_comp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Decompress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++)
-    LZ4_decompress_safe(bufs[i].compressed, bufs[i].decompressed, bufs[i].comp_size, bufs[i].raw_size);
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->lz4_decomp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Validation and Size Storage
-  tmp_size = 0;
-  for(int i=s_idx; i<=e_idx; i++) {
-    if(bufs[i].comp_size < 0)
-      fatal(E_GENERIC, "%s (id: %d)", "There was a problem with buffer", i);
-    tmp_size += bufs[i].comp_size;
-  }
-  increment_result_value(res, &res->lz4_comp_size, tmp_size);
 
-  // -- ZLIB
-  // Compress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  uLongf max_compressed_size = 0;
-  uLongf data_length = 0;
-  for(int i=s_idx; i<=e_idx; i++) {
-    max_compressed_size = compressBound(bufs[i].raw_size);
-    zlib_errors += compress2(bufs[i].compressed, &max_compressed_size, bufs[i].raw, bufs[i].raw_size, ZLIB_LEVEL);
-    bufs[i].comp_size = max_compressed_size;
+
+/*
+ *  Codec descriptor table.  Each codec is a handful of functions over a buffer plus a level; run_test() only ever calls
+ *  through these, so a new codec, level or variant is a new table entry rather than another copy of the timing loop.
+ */
+int64_t memcpy_compress(codec *self, void *state, buffer *buf) {
+  // The baseline: what moving the bytes costs without doing anything clever to them.
+  (void)self; (void)state;
+  memcpy(buf->compressed, buf->raw, buf->raw_size);
+  return buf->raw_size;
+}
+int64_t memcpy_decompress(codec *self, void *state, buffer *buf) {
+  (void)self; (void)state;
+  memcpy(buf->decompressed, buf->compressed, buf->comp_size);
+  return buf->comp_size;
+}
+uint64_t memcpy_bound(codec *self, uint64_t raw_size) {
+  (void)self;
+  return raw_size;
+}
+int64_t lz4_compress(codec *self, void *state, buffer *buf) {
+  int size = 0;
+  (void)state;
+  if(self->level == LZ4_ACCELERATION)
+    size = LZ4_compress_default(buf->raw, buf->compressed, buf->raw_size, buf->comp_bound);
+  else
+    size = LZ4_compress_fast(buf->raw, buf->compressed, buf->raw_size, buf->comp_bound, self->level);
+  return size > 0 ? size : -1;
+}
+int64_t lz4_decompress(codec *self, void *state, buffer *buf) {
+  (void)self; (void)state;
+  return LZ4_decompress_safe(buf->compressed, buf->decompressed, buf->comp_size, buf->raw_size);
+}
+uint64_t lz4_bound(codec *self, uint64_t raw_size) {
+  (void)self;
+  return LZ4_compressBound(raw_size);
+}
+int64_t zlib_compress(codec *self, void *state, buffer *buf) {
+  // The stateless baseline: compress2() sets up (and tears down) a full default deflate stream on every call.
+  uLongf size = buf->comp_bound;
+  (void)state;
+  if(compress2(buf->compressed, &size, buf->raw, buf->raw_size, self->level) != Z_OK)
+    return -1;
+  return size;
+}
+int64_t zlib_decompress(codec *self, void *state, buffer *buf) {
+  uLongf size = buf->raw_size;
+  (void)self; (void)state;
+  if(uncompress(buf->decompressed, &size, buf->compressed, buf->comp_size) != Z_OK)
+    return -1;
+  return size;
+}
+uint64_t zlib_bound(codec *self, uint64_t raw_size) {
+  (void)self;
+  return compressBound(raw_size);
+}
+int zlib_window_bits(uint64_t raw_size) {
+  // Smallest window that still covers the block (zlib won't go under 9).  Tiny blocks then skip most of the 256 KiB of
+  // state setup that compress2() pays on every call.  The output isn't byte-identical to compress2()'s though: the
+  // smaller hash table (memLevel follows the window) finds slightly different matches.
+  int bits = 9;
+  while(bits < MAX_WBITS && ((uint64_t)1 << bits) < raw_size)
+    bits++;
+  return bits;
+}
+int64_t zlib_win_compress(codec *self, void *state, buffer *buf) {
+  z_stream stream;
+  int bits = zlib_window_bits(buf->raw_size);
+  int64_t size = -1;
+  (void)state;
+  memset(&stream, 0, sizeof(stream));
+  // memLevel follows the window down from the default 8, so the hash table shrinks with it.
+  if(deflateInit2(&stream, self->level, Z_DEFLATED, bits, bits - 7, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  stream.next_in = buf->raw;
+  stream.avail_in = buf->raw_size;
+  stream.next_out = buf->compressed;
+  stream.avail_out = buf->comp_bound;
+  if(deflate(&stream, Z_FINISH) == Z_STREAM_END)
+    size = stream.total_out;
+  deflateEnd(&stream);
+  return size;
+}
+uint64_t zlib_win_bound(codec *self, uint64_t raw_size) {
+  // compressBound() only holds for the default window and memLevel; below that, stored blocks are smaller and their
+  // headers add up, so use deflateBound()'s conservative formula.
+  (void)self;
+  if(zlib_window_bits(raw_size) == MAX_WBITS)
+    return compressBound(raw_size);
+  return raw_size + ((raw_size + 7) >> 3) + ((raw_size + 63) >> 6) + 5 + 6;
+}
+ZSTD_parameters zstd_params(int level, uint64_t raw_size) {
+  // The level's own table for this source size (which is all ZSTD_compress() does), except that a block bigger than the
+  // level's window gets a window covering the whole block; a block is independent, so nothing in it should be out of
+  // reach.  ZSTD_adjustCParams() then trims hash/chain sizes to fit, and shrinks everything for tiny blocks.
+  ZSTD_parameters params = ZSTD_getParams(level, raw_size, 0);
+  unsigned max_log = sizeof(void *) == 4 ? ZSTD_WINDOWLOG_MAX_32 : ZSTD_WINDOWLOG_MAX_64;
+  while(params.cParams.windowLog < max_log && ((uint64_t)1 << params.cParams.windowLog) < raw_size)
+    params.cParams.windowLog++;
+  params.cParams = ZSTD_adjustCParams(params.cParams, raw_size, 0);
+  params.fParams.contentSizeFlag = 1;
+  return params;
+}
+int64_t zstd_compress(codec *self, void *state, buffer *buf) {
+  // A context per call, same as ZSTD_compress() keeps on its stack, so this is still the stateless path.
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  size_t size = 0;
+  (void)state;
+  if(cctx == NULL)
+    return -1;
+  size = ZSTD_compress_advanced(cctx, buf->compressed, buf->comp_bound, buf->raw, buf->raw_size, NULL, 0,
+                                zstd_params(self->level, buf->raw_size));
+  ZSTD_freeCCtx(cctx);
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+int64_t zstd_decompress(codec *self, void *state, buffer *buf) {
+  size_t size = 0;
+  (void)self; (void)state;
+  size = ZSTD_decompress(buf->decompressed, buf->raw_size, buf->compressed, buf->comp_size);
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+uint64_t zstd_bound(codec *self, uint64_t raw_size) {
+  (void)self;
+  return ZSTD_compressBound(raw_size);
+}
+// Context-reuse variants, the way a long-lived server calls these libraries: every worker keeps one LZ4 state and one
+// zstd CCtx/DCtx pair from codec_open_states() on, so a block pays for resetting them rather than building them.
+void *lz4_ctx_init(codec *self) {
+  void *state = malloc(LZ4_sizeofState());
+  (void)self;
+  if(state == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate an LZ4 state.");
+  return state;
+}
+void lz4_ctx_teardown(codec *self, void *state) {
+  (void)self;
+  free(state);
+}
+int64_t lz4_ctx_compress(codec *self, void *state, buffer *buf) {
+  int size = LZ4_compress_fast_extState(state, buf->raw, buf->compressed, buf->raw_size, buf->comp_bound, self->level);
+  return size > 0 ? size : -1;
+}
+typedef struct zstd_contexts zstd_contexts;
+struct zstd_contexts {
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+};
+void *zstd_ctx_init(codec *self) {
+  zstd_contexts *ctx = malloc(sizeof(zstd_contexts));
+  (void)self;
+  if(ctx == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate zstd contexts.");
+  ctx->cctx = ZSTD_createCCtx();
+  ctx->dctx = ZSTD_createDCtx();
+  if(ctx->cctx == NULL || ctx->dctx == NULL)
+    fatal(E_GENERIC, "%s", "Failed to create a zstd compression or decompression context.");
+  return ctx;
+}
+void zstd_ctx_teardown(codec *self, void *state) {
+  zstd_contexts *ctx = state;
+  (void)self;
+  ZSTD_freeCCtx(ctx->cctx);
+  ZSTD_freeDCtx(ctx->dctx);
+  free(ctx);
+}
+int64_t zstd_ctx_compress(codec *self, void *state, buffer *buf) {
+  // Same parameters as zstd_compress(), so only the context handling differs.
+  zstd_contexts *ctx = state;
+  size_t size = ZSTD_compress_advanced(ctx->cctx, buf->compressed, buf->comp_bound, buf->raw, buf->raw_size, NULL, 0,
+                                       zstd_params(self->level, buf->raw_size));
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+int64_t zstd_ctx_decompress(codec *self, void *state, buffer *buf) {
+  zstd_contexts *ctx = state;
+  size_t size = 0;
+  (void)self;
+  size = ZSTD_decompressDCtx(ctx->dctx, buf->decompressed, buf->raw_size, buf->compressed, buf->comp_size);
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+// zlib's context-reuse variant.  One deflate stream set up with compress2()'s parameters and one inflate stream, both
+// reset per block instead of rebuilt, so the output matches zlib's byte for byte and only the per-call setup differs.  zlib's internal allocations go through a per-thread
+// free-list pool: blocks are recycled by size and only really freed at teardown, so once a thread has seen each size
+// nothing is malloc()ed per block (deflateCopy() clones included).
+#define ZLIB_POOL_HEADER 64   // Keeps the payload on a cache line boundary.
+typedef struct zlib_pool_block zlib_pool_block;
+struct zlib_pool_block {
+  zlib_pool_block *next;
+  uint64_t        size;
+};
+__thread zlib_pool_block *zlib_free_blocks = NULL;
+voidpf zlib_pool_alloc(voidpf opaque, uInt items, uInt size) {
+  // The pool is the calling thread's, not the stream's, since deflateCopy() hands the source's zalloc to the clone.
+  uint64_t bytes = (uint64_t)items * size;
+  zlib_pool_block **link = &zlib_free_blocks, *block = NULL;
+  (void)opaque;
+  for(; *link != NULL; link = &(*link)->next) {
+    if((*link)->size == bytes) {
+      block = *link;
+      *link = block->next;
+      return (char *)block + ZLIB_POOL_HEADER;
+    }
   }
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->zlib_comp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Decompress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++) {
-    data_length = bufs[i].raw_size;
-    zlib_errors += uncompress(bufs[i].decompressed, &data_length, bufs[i].compressed, bufs[i].comp_size);
+  if(posix_memalign((void **)&block, ZLIB_POOL_HEADER, ZLIB_POOL_HEADER + bytes) != 0)
+    return Z_NULL;
+  block->size = bytes;
+  return (char *)block + ZLIB_POOL_HEADER;
+}
+void zlib_pool_free(voidpf opaque, voidpf address) {
+  zlib_pool_block *block = (zlib_pool_block *)((char *)address - ZLIB_POOL_HEADER);
+  (void)opaque;
+  block->next = zlib_free_blocks;
+  zlib_free_blocks = block;
+}
+void zlib_pool_drain() {
+  zlib_pool_block *block = NULL;
+  while((block = zlib_free_blocks) != NULL) {
+    zlib_free_blocks = block->next;
+    free(block);
   }
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->zlib_decomp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Validation and Size Storage
-  tmp_size = 0;
-  if(zlib_errors > 0)
-    fatal(E_GENERIC, "%s (errors: %i)", "Ran into a compression problem with zlib.", zlib_errors);
-  for(int i=s_idx; i<=e_idx; i++)
-    tmp_size += bufs[i].comp_size;
-  increment_result_value(res, &res->zlib_comp_size, tmp_size);
-
-  // -- ZSTD
-  // Compress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++)
-    bufs[i].comp_size = ZSTD_compress(bufs[i].compressed, bufs[i].raw_size + 512, bufs[i].raw, bufs[i].raw_size, ZSTD_LEVEL);
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->zstd_comp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Decompress Time
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  for(int i=s_idx; i<=e_idx; i++)
-    ZSTD_decompress(bufs[i].decompressed, bufs[i].raw_size, bufs[i].compressed, bufs[i].comp_size);
-  clock_gettime(CLOCK_MONOTONIC, &end);
-  increment_result_value(res, &res->zstd_decomp_time, BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec);
-  // Validation and Size Storage
-  tmp_size = 0;
-  for(int i=s_idx; i<=e_idx; i++) {
-    if(bufs[i].comp_size < 0)
-      fatal(E_GENERIC, "%s (id: %d)", "There was a problem with buffer", i);
-    tmp_size += bufs[i].comp_size;
+}
+void zlib_pool_stream(z_stream *stream) {
+  memset(stream, 0, sizeof(z_stream));
+  stream->zalloc = &zlib_pool_alloc;
+  stream->zfree = &zlib_pool_free;
+}
+typedef struct zlib_engine zlib_engine;
+struct zlib_engine {
+  z_stream deflater;
+  z_stream inflater;
+};
+void *zlib_ctx_init(codec *self) {
+  zlib_engine *engine = calloc(1, sizeof(zlib_engine));
+  if(engine == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate a zlib engine.");
+  zlib_pool_stream(&engine->deflater);
+  if(deflateInit(&engine->deflater, self->level) != Z_OK)
+    fatal(E_GENERIC, "%s", "Failed to set up a reusable zlib deflate stream.");
+  zlib_pool_stream(&engine->inflater);
+  if(inflateInit2(&engine->inflater, MAX_WBITS) != Z_OK)
+    fatal(E_GENERIC, "%s", "Failed to set up a reusable zlib inflate stream.");
+  return engine;
+}
+void zlib_ctx_teardown(codec *self, void *state) {
+  zlib_engine *engine = state;
+  (void)self;
+  deflateEnd(&engine->deflater);
+  inflateEnd(&engine->inflater);
+  free(engine);
+  zlib_pool_drain();
+}
+int64_t zlib_ctx_compress(codec *self, void *state, buffer *buf) {
+  zlib_engine *engine = state;
+  z_stream *stream = &engine->deflater;
+  (void)self;
+  if(deflateReset(stream) != Z_OK)
+    return -1;
+  stream->next_in = buf->raw;
+  stream->avail_in = buf->raw_size;
+  stream->next_out = buf->compressed;
+  stream->avail_out = buf->comp_bound;
+  if(deflate(stream, Z_FINISH) != Z_STREAM_END)
+    return -1;
+  return stream->total_out;
+}
+int64_t zlib_ctx_decompress(codec *self, void *state, buffer *buf) {
+  zlib_engine *engine = state;
+  z_stream *stream = &engine->inflater;
+  (void)self;
+  if(inflateReset(stream) != Z_OK)
+    return -1;
+  stream->next_in = buf->compressed;
+  stream->avail_in = buf->comp_size;
+  stream->next_out = buf->decompressed;
+  stream->avail_out = buf->raw_size;
+  if(inflate(stream, Z_FINISH) != Z_STREAM_END)
+    return -1;
+  return stream->total_out;
+}
+// Dictionary variant.  One CDict/DDict pair digests the trained dictionary up front; zstd documents both as safe to share
+// read-only between threads, so every worker compresses against the same pair with its own CCtx/DCtx.
+typedef struct zstd_dictionaries zstd_dictionaries;
+struct zstd_dictionaries {
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+};
+void *zstd_dict_prepare(codec *self) {
+  zstd_dictionaries *dicts = malloc(sizeof(zstd_dictionaries));
+  if(dicts == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate zstd dictionaries.");
+  dicts->cdict = ZSTD_createCDict(corpus_dict.content, corpus_dict.size, self->level);
+  dicts->ddict = ZSTD_createDDict(corpus_dict.content, corpus_dict.size);
+  if(dicts->cdict == NULL || dicts->ddict == NULL)
+    fatal(E_GENERIC, "%s", "Failed to digest the dictionary for zstd.");
+  return dicts;
+}
+void zstd_dict_release(codec *self, void *shared) {
+  zstd_dictionaries *dicts = shared;
+  (void)self;
+  ZSTD_freeCDict(dicts->cdict);
+  ZSTD_freeDDict(dicts->ddict);
+  free(dicts);
+}
+int64_t zstd_dict_compress(codec *self, void *state, buffer *buf) {
+  zstd_contexts *ctx = state;
+  zstd_dictionaries *dicts = self->shared;
+  size_t size = ZSTD_compress_usingCDict(ctx->cctx, buf->compressed, buf->comp_bound, buf->raw, buf->raw_size, dicts->cdict);
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+int64_t zstd_dict_decompress(codec *self, void *state, buffer *buf) {
+  zstd_contexts *ctx = state;
+  zstd_dictionaries *dicts = self->shared;
+  size_t size = ZSTD_decompress_usingDDict(ctx->dctx, buf->decompressed, buf->raw_size, buf->compressed, buf->comp_size,
+                                           dicts->ddict);
+  return ZSTD_isError(size) ? -1 : (int64_t)size;
+}
+// LZ4 can only reach back 64 KiB, so it uses the tail of the dictionary (where the trainer put the best segments).  The
+// dictionary is hashed into one primed stream up front; each block starts from a copy of it instead of LZ4_loadDict().
+#define LZ4_DICT_MAX (64 * 1024)
+void lz4_dict_window(char **dict, int *size) {
+  *size = corpus_dict.size < LZ4_DICT_MAX ? (int)corpus_dict.size : LZ4_DICT_MAX;
+  *dict = (char *)corpus_dict.content + corpus_dict.size - *size;
+}
+void *lz4_dict_prepare(codec *self) {
+  LZ4_stream_t *primed = LZ4_createStream();
+  char *dict = NULL;
+  int size = 0;
+  (void)self;
+  if(primed == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate an LZ4 stream.");
+  lz4_dict_window(&dict, &size);
+  LZ4_loadDict(primed, dict, size);
+  return primed;
+}
+void lz4_dict_release(codec *self, void *shared) {
+  (void)self;
+  LZ4_freeStream(shared);
+}
+void *lz4_dict_init(codec *self) {
+  LZ4_stream_t *stream = LZ4_createStream();
+  (void)self;
+  if(stream == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate an LZ4 stream.");
+  return stream;
+}
+void lz4_dict_teardown(codec *self, void *state) {
+  (void)self;
+  LZ4_freeStream(state);
+}
+int64_t lz4_dict_compress(codec *self, void *state, buffer *buf) {
+  int size = 0;
+  memcpy(state, self->shared, sizeof(LZ4_stream_t));
+  size = LZ4_compress_fast_continue(state, buf->raw, buf->compressed, buf->raw_size, buf->comp_bound, self->level);
+  return size > 0 ? size : -1;
+}
+int64_t lz4_dict_decompress(codec *self, void *state, buffer *buf) {
+  char *dict = NULL;
+  int size = 0;
+  (void)self; (void)state;
+  lz4_dict_window(&dict, &size);
+  return LZ4_decompress_safe_usingDict(buf->compressed, buf->decompressed, buf->comp_size, buf->raw_size, dict, size);
+}
+// zlib's preset dictionary is at most its 32 KiB window, again taken from the tail.  Blocks get a window covering the
+// dictionary plus the block.  prepare() primes one deflate stream per window size with deflateSetDictionary(), and each
+// block compresses on a deflateCopy() clone of it, so the dictionary is inserted into the hash chains once, not per
+// block.  Inflate has to be handed the dictionary when it asks (Z_NEED_DICT); that is only a copy into its window.
+#define ZLIB_DICT_MAX (32 * 1024)
+typedef struct zlib_dict_state zlib_dict_state;
+struct zlib_dict_state {
+  z_stream deflater;   // The current block's clone of a primed stream.
+  z_stream inflater;
+};
+void zlib_dict_window(unsigned char **dict, uInt *size) {
+  *size = corpus_dict.size < ZLIB_DICT_MAX ? (uInt)corpus_dict.size : ZLIB_DICT_MAX;
+  *dict = (unsigned char *)corpus_dict.content + corpus_dict.size - *size;
+}
+int zlib_dict_bits(uint64_t raw_size) {
+  unsigned char *dict = NULL;
+  uInt size = 0;
+  zlib_dict_window(&dict, &size);
+  return zlib_window_bits(raw_size + size);
+}
+void *zlib_dict_prepare(codec *self) {
+  z_stream *primed = calloc(MAX_WBITS + 1, sizeof(z_stream));
+  unsigned char *dict = NULL;
+  uInt size = 0;
+  if(primed == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate primed zlib streams.");
+  zlib_dict_window(&dict, &size);
+  for(int bits=9; bits<=MAX_WBITS; bits++) {
+    zlib_pool_stream(&primed[bits]);
+    if(deflateInit2(&primed[bits], self->level, Z_DEFLATED, bits, bits - 7, Z_DEFAULT_STRATEGY) != Z_OK ||
+       deflateSetDictionary(&primed[bits], dict, size) != Z_OK)
+      fatal(E_GENERIC, "%s", "Failed to prime a zlib stream with the dictionary.");
   }
-  increment_result_value(res, &res->zstd_comp_size, tmp_size);
+  return primed;
 }
-void run_test_wrapper(test_wrapper *wrapper) {
-  run_test(wrapper->res, wrapper->src, wrapper->block_size, wrapper->s_idx, wrapper->e_idx);
+void zlib_dict_release(codec *self, void *shared) {
+  z_stream *primed = shared;
+  (void)self;
+  for(int bits=9; bits<=MAX_WBITS; bits++)
+    deflateEnd(&primed[bits]);
+  free(primed);
+  zlib_pool_drain();
 }
-void compression_test(src_file *src, int block_size) {
-  // Locals
-  result res;
-  res.lz4_comp_size = 0;
-  res.lz4_comp_time = 0;
-  res.lz4_decomp_time = 0;
-  res.zlib_comp_size = 0;
-  res.zlib_comp_time = 0;
-  res.zlib_decomp_time = 0;
-  res.zstd_comp_size = 0;
-  res.zstd_comp_time = 0;
-  res.zstd_decomp_time = 0;
-  res.memcpy_time = 0;
-  pthread_mutex_init(&res.lock, NULL);
-  int buffer_count = 0;
-
-  // To avoid repeatedly malloc/free()-ing we'll just over allocate now and reuse.
-  buffer_count = src->size / block_size;
-  if(src->size % block_size > 0)
-    buffer_count++;
-  for(int i=0; i<buffer_count; i++) {
-    bufs[i].comp_size = 0;
-    bufs[i].raw_size = block_size;
-    if(i + 1 == buffer_count && src->size % block_size > 0)
-      bufs[i].raw_size = src->size % block_size;
-    bufs[i].raw = malloc(bufs[i].raw_size);
-    bufs[i].compressed = malloc(bufs[i].raw_size + 512);  // Overkill but meh.
-    bufs[i].decompressed = malloc(bufs[i].raw_size);
-    if(bufs[i].raw == NULL || bufs[i].compressed == NULL || bufs[i].decompressed == NULL)
-      fatal(E_GENERIC, "%s", "Failed to allocate memory for buffers.");
-  }
-  // Copy some result values for the test.
-  res.src = src;
-  res.block_size = block_size;
-  res.blocks = buffer_count;
-
-  // If we're MT, act differently.  Time real-time.
-  if(THREADS > 1) {
-    pthread_t workers[THREADS];
-    test_wrapper wrappers[THREADS];
-    for(int i=0; i<THREADS; i++) {
-      // Set up the wrapper with points and static values.
-      wrappers[i].block_size = block_size;
-      wrappers[i].buffer_count = buffer_count;
-      wrappers[i].res = &res;
-      wrappers[i].src = src;
-      // Calculate the indexes, then spin up a thread and change the start index for the next loop.
-      wrappers[i].s_idx = (((i+0) * buffer_count) / THREADS);
-      wrappers[i].e_idx = (((i+1) * buffer_count) / THREADS) - 1;
-      pthread_create(&workers[i], NULL, (void *) &run_test_wrapper, &wrappers[i]);
+void *zlib_dict_init(codec *self) {
+  zlib_dict_state *state = calloc(1, sizeof(zlib_dict_state));
+  (void)self;
+  if(state == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate a zlib dictionary state.");
+  zlib_pool_stream(&state->inflater);
+  if(inflateInit2(&state->inflater, MAX_WBITS) != Z_OK)
+    fatal(E_GENERIC, "%s", "Failed to set up a reusable zlib inflate stream.");
+  return state;
+}
+void zlib_dict_teardown(codec *self, void *state) {
+  zlib_dict_state *dict_state = state;
+  (void)self;
+  inflateEnd(&dict_state->inflater);
+  free(dict_state);
+  zlib_pool_drain();
+}
+int64_t zlib_dict_compress(codec *self, void *state, buffer *buf) {
+  zlib_dict_state *dict_state = state;
+  z_stream *primed = self->shared, *stream = &dict_state->deflater;
+  int64_t size = -1;
+  if(deflateCopy(stream, &primed[zlib_dict_bits(buf->raw_size)]) != Z_OK)
+    return -1;
+  stream->next_in = buf->raw;
+  stream->avail_in = buf->raw_size;
+  stream->next_out = buf->compressed;
+  stream->avail_out = buf->comp_bound;
+  if(deflate(stream, Z_FINISH) == Z_STREAM_END)
+    size = stream->total_out;
+  deflateEnd(stream);
+  return size;
+}
+int64_t zlib_dict_decompress(codec *self, void *state, buffer *buf) {
+  zlib_dict_state *dict_state = state;
+  z_stream *stream = &dict_state->inflater;
+  unsigned char *dict = NULL;
+  uInt size = 0;
+  int status = Z_OK;
+  (void)self;
+  if(inflateReset(stream) != Z_OK)
+    return -1;
+  stream->next_in = buf->compressed;
+  stream->avail_in = buf->comp_size;
+  stream->next_out = buf->decompressed;
+  stream->avail_out = buf->raw_size;
+  status = inflate(stream, Z_FINISH);
+  if(status == Z_NEED_DICT) {
+    zlib_dict_window(&dict, &size);
+    if(inflateSetDictionary(stream, dict, size) != Z_OK)
+      return -1;
+    status = inflate(stream, Z_FINISH);
+  }
+  return status == Z_STREAM_END ? (int64_t)stream->total_out : -1;
+}
+uint64_t zlib_dict_bound(codec *self, uint64_t raw_size) {
+  // Windows here never shrink to the block, so take deflateBound()'s conservative formula, plus the 4-byte DICTID.
+  (void)self;
+  return raw_size + ((raw_size + 7) >> 3) + ((raw_size + 63) >> 6) + 5 + 6 + 4;
+}
+// Name, label, default level, level range, then init/compress/decompress/bound/teardown, the baseline of a variant and
+// prepare/release for shared data.  zstd's 22 is ZSTD_maxCLevel(), which the header only offers as a function.
+const codec codec_kinds[] = {
+  {"memcpy",    "Memcpy", 0,                0, 0,     NULL,           &memcpy_compress,    &memcpy_decompress,
+   &memcpy_bound, NULL,               NULL,   0, NULL,               NULL,               NULL},
+  {"lz4",       "LZ4",    LZ4_ACCELERATION, 1, 65537, NULL,           &lz4_compress,       &lz4_decompress,
+   &lz4_bound,    NULL,               NULL,   0, NULL,               NULL,               NULL},
+  {"zlib",      "ZLIB",   ZLIB_LEVEL,       1, 9,     NULL,           &zlib_compress,      &zlib_decompress,
+   &zlib_bound,   NULL,               NULL,   0, NULL,               NULL,               NULL},
+  {"zstd",      "ZSTD",   ZSTD_LEVEL,       1, 22,    NULL,           &zstd_compress,      &zstd_decompress,
+   &zstd_bound,   NULL,               NULL,   0, NULL,               NULL,               NULL},
+  {"lz4-ctx",   "LZ4c",   LZ4_ACCELERATION, 1, 65537, &lz4_ctx_init,  &lz4_ctx_compress,   &lz4_decompress,
+   &lz4_bound,    &lz4_ctx_teardown,  "lz4",  0, NULL,               NULL,               NULL},
+  {"zstd-ctx",  "ZSTDc",  ZSTD_LEVEL,       1, 22,    &zstd_ctx_init, &zstd_ctx_compress,  &zstd_ctx_decompress,
+   &zstd_bound,   &zstd_ctx_teardown, "zstd", 0, NULL,               NULL,               NULL},
+  {"zlib-ctx",  "ZLIBc",  ZLIB_LEVEL,       1, 9,     &zlib_ctx_init, &zlib_ctx_compress,  &zlib_ctx_decompress,
+   &zlib_bound,   &zlib_ctx_teardown, "zlib", 0, NULL,               NULL,               NULL},
+  {"zlib-win",  "ZLIBw",  ZLIB_LEVEL,       1, 9,     NULL,           &zlib_win_compress,  &zlib_decompress,
+   &zlib_win_bound, NULL,             "zlib", 0, NULL,               NULL,               NULL},
+  {"zstd-dict", "ZSTDd",  ZSTD_LEVEL,       1, 22,    &zstd_ctx_init, &zstd_dict_compress, &zstd_dict_decompress,
+   &zstd_bound,   &zstd_ctx_teardown, "zstd", 0, &zstd_dict_prepare, &zstd_dict_release, NULL},
+  {"lz4-dict",  "LZ4d",   LZ4_ACCELERATION, 1, 65537, &lz4_dict_init, &lz4_dict_compress,  &lz4_dict_decompress,
+   &lz4_bound,    &lz4_dict_teardown, "lz4",  0, &lz4_dict_prepare,  &lz4_dict_release,  NULL},
+  {"zlib-dict", "ZLIBd",  ZLIB_LEVEL,       1, 9,     &zlib_dict_init, &zlib_dict_compress, &zlib_dict_decompress,
+   &zlib_dict_bound, &zlib_dict_teardown, "zlib", 0, &zlib_dict_prepare, &zlib_dict_release, NULL},
+};
+#define CODEC_KINDS ((int)(sizeof(codec_kinds) / sizeof(codec)))
+void add_codec(char *spec) {
+  // spec is "name" or "name:level".  The default level keeps the plain name so the usual columns read as before.
+  char *colon = strchr(spec, ':');
+  int name_length = colon == NULL ? (int)strlen(spec) : (int)(colon - spec);
+  const codec *kind = NULL;
+  codec *c = &codecs[CODEC_COUNT];
+  char known[256] = "";
+  if(CODEC_COUNT == MAX_CODECS)
+    fatal(E_GENERIC, "%s%i%s", "At most ", MAX_CODECS, " codecs can be run at once.");
+  for(int i=0; i<CODEC_KINDS && kind == NULL; i++) {
+    if((int)strlen(codec_kinds[i].name) == name_length && strncmp(codec_kinds[i].name, spec, name_length) == 0)
+      kind = &codec_kinds[i];
+  }
+  if(kind == NULL) {
+    for(int i=0; i<CODEC_KINDS; i++)
+      snprintf(known + strlen(known), sizeof(known) - strlen(known), "%s%.31s", i > 0 ? ", " : "", codec_kinds[i].name);
+    fatal(E_GENERIC, "%s%s%s%s", "Unknown codec in --codecs: ", spec, "; try one of ", known);
+  }
+  *c = *kind;
+  c->kind = kind - codec_kinds;
+  if(colon != NULL) {
+    c->level = atoi(colon + 1);
+    if(c->level < c->min_level || c->level > c->max_level)
+      fatal(E_GENERIC, "%s%s%s%i%s%i", "Level out of range in --codecs: ", spec, "; use ", c->min_level, " to ", c->max_level);
+    snprintf(c->name, sizeof(c->name), "%.15s:%i", kind->name, c->level);
+    snprintf(c->label, sizeof(c->label), "%.11s-%i", kind->label, c->level);
+  }
+  CODEC_COUNT++;
+}
+void parse_codec_list(char *list) {
+  char *token = NULL, *save = NULL;
+  list = strdup(list);
+  for(token = strtok_r(list, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save))
+    add_codec(token);
+  free(list);
+}
+void add_sweep_codecs() {
+  char spec[32];
+  for(int acceleration=1; acceleration<=LZ4_SWEEP_MAX; acceleration*=2) {
+    snprintf(spec, sizeof(spec), "lz4:%i", acceleration);
+    add_codec(spec);
+  }
+  for(int level=1; level<=9; level++) {
+    snprintf(spec, sizeof(spec), "zlib:%i", level);
+    add_codec(spec);
+  }
+  for(int level=1; level<=ZSTD_maxCLevel(); level++) {
+    snprintf(spec, sizeof(spec), "zstd:%i", level);
+    add_codec(spec);
+  }
+}
+void add_context_twins() {
+  // Only the codecs given so far; twins are appended, so each pair reads left to right in the table.
+  char spec[48];
+  int count = CODEC_COUNT;
+  for(int id=0; id<count; id++) {
+    for(int kind=0; kind<CODEC_KINDS; kind++) {
+      if(codec_kinds[kind].baseline == NULL || strcmp(codec_kinds[kind].baseline, codec_kinds[codecs[id].kind].name) != 0)
+        continue;
+      if(strstr(codec_kinds[kind].name, "-ctx") == NULL)
+        continue;  // Other variants (dictionaries) change more than the context handling.
+      if(codecs[id].level == codec_kinds[kind].level)
+        snprintf(spec, sizeof(spec), "%.31s", codec_kinds[kind].name);
+      else
+        snprintf(spec, sizeof(spec), "%.31s:%i", codec_kinds[kind].name, codecs[id].level);
+      add_codec(spec);
     }
-    for(int i=0; i<THREADS; i++)
-      pthread_join(workers[i], NULL);
-  } else {
-    // Just run the test directly.
-    run_test(&res, src, block_size, 0, buffer_count - 1);
   }
-
-  // Print results.
-  print_result(&res);
-
-  // Clean up and leave.
-  for(int i=0; i<buffer_count; i++) {
-    free(bufs[i].compressed);
-    free(bufs[i].decompressed);
-    free(bufs[i].raw);
+}
+int codec_baseline(int id) {
+  // The codec a variant is compared against: its baseline kind at the same level, if that's in the run too.
+  if(codecs[id].baseline == NULL)
+    return -1;
+  for(int other=0; other<CODEC_COUNT; other++) {
+    if(strcmp(codec_kinds[codecs[other].kind].name, codecs[id].baseline) == 0 && codecs[other].level == codecs[id].level)
+      return other;
   }
+  return -1;
 }
-
-
-/*
- *  Warm up the CPU to avoid skews from thottling.
- */
-void waste_cpu_time() {
-  // Using the LZ4 example (which I wrote years ago), repeatedly compress and decompress the
-  // same buffer to waste CPU time in a complex-enough manner to not be optimized-out by gcc.
-  time_t start = time(0);
-  const char* const src = "Lorem ipsum dolor sit amet, consectetur adipiscing elit.";
-  const int src_size = (int)(strlen(src) + 1);
-  const int max_dst_size = LZ4_compressBound(src_size);
-  char* compressed_data = malloc(max_dst_size);
-  char* const regen_buffer = malloc(src_size);
-  const int compressed_data_size = LZ4_compress_default(src, compressed_data, src_size, max_dst_size);
-  while(time(0) - start < WARMUP_SEC) {
-    // compresss it
-    LZ4_compress_default(src, compressed_data, src_size, max_dst_size);
-    // now decompress it... yep
-    LZ4_decompress_safe(compressed_data, regen_buffer, compressed_data_size, src_size);
+int codecs_need_dictionary() {
+  // Shared data is only ever made from the dictionary, so any codec that prepares some needs one trained.
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(codecs[id].prepare != NULL)
+      return 1;
   }
+  return 0;
 }
-void warm_up() {
-  pthread_t time_wasters[THREADS];
-  for(int i=0; i<THREADS; i++)
-    pthread_create(&time_wasters[i], NULL, (void *) &waste_cpu_time, NULL);
-  for(int i=0; i<THREADS; i++)
-    pthread_join(time_wasters[i], NULL);
+void codec_prepare_shared() {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int id=0; id<CODEC_COUNT; id++)
+    codecs[id].shared = codecs[id].prepare == NULL ? NULL : codecs[id].prepare(&codecs[id]);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  corpus_dict.prepare_time = BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+}
+void codec_release_shared() {
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(codecs[id].release != NULL && codecs[id].shared != NULL)
+      codecs[id].release(&codecs[id], codecs[id].shared);
+    codecs[id].shared = NULL;
+  }
+}
+void codec_open_states() {
+  // Called by each pool worker before its first job, so context setup never lands in a timed phase.
+  for(int id=0; id<CODEC_COUNT; id++)
+    codec_states[id] = codecs[id].init == NULL ? NULL : codecs[id].init(&codecs[id]);
+}
+void codec_close_states() {
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(codecs[id].teardown != NULL)
+      codecs[id].teardown(&codecs[id], codec_states[id]);
+    codec_states[id] = NULL;
+  }
 }
 
 
 
 /*
- *  Main function, initialization point for program.
+ *  Arena for the block buffers.  Rather than malloc() three times per block we map one region big enough for the largest
+ *  block size of a file and hand out slices.  Resetting is just rewinding the offset, so every block size reuses the
+ *  same (already faulted-in) pages.
  */
-int main(int argc, char **argv) {
+uint64_t align_up(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+uint64_t max_compress_bound(uint64_t raw_size) {
+  uint64_t bound = raw_size;
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(codecs[id].bound(&codecs[id], raw_size) > bound)
+      bound = codecs[id].bound(&codecs[id], raw_size);
+  }
+  return bound;
+}
+uint64_t block_size_for(src_file *src, int block_id) {
+  // Whole-file blocks of an empty file still need a non-zero size to divide by.
+  if(BLOCK_SIZES[block_id] == 0)
+    return src->size > 0 ? src->size : MIN_BLOCK_SIZE;
+  return BLOCK_SIZES[block_id];
+}
+uint64_t arena_size_for(src_file *src) {
+  // Walk each block size and keep the most demanding; a block costs raw + bound + decompressed, each aligned.  Mapped
+  // files don't need a raw slice since blocks point straight into the mapping.
+  uint64_t largest = 0;
+  uint64_t raw_copies = src->mapped ? 1 : 2;
+  for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++) {
+    uint64_t block_size = block_size_for(src, block_id);
+    uint64_t full_blocks = src->size / block_size;
+    uint64_t tail = src->size % block_size;
+    uint64_t needed = full_blocks * (raw_copies * align_up(block_size, ARENA_ALIGN) + align_up(max_compress_bound(block_size), ARENA_ALIGN));
+    if(tail > 0)
+      needed += raw_copies * align_up(tail, ARENA_ALIGN) + align_up(max_compress_bound(tail), ARENA_ALIGN);
+    if(needed > largest)
+      largest = needed;
+  }
+  return largest;
+}
+void arena_release(arena *a) {
+  if(a->base != NULL)
+    munmap(a->base, a->capacity);
+  a->base = NULL;
+  a->capacity = 0;
+  a->used = 0;
+}
+void arena_reserve(arena *a, uint64_t size) {
+  // Only ever grows; a smaller file just uses the front of the existing mapping.
+  a->used = 0;
+  if(size <= a->capacity)
+    return;
+  arena_release(a);
+  a->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(a->base == MAP_FAILED) {
+    a->base = NULL;
+    fatal(E_GENERIC, "%s%lu%s", "Failed to map ", size, " bytes for the buffer arena.");
+  }
+  a->capacity = size;
+}
+void arena_reset(arena *a) {
+  a->used = 0;
+}
+void *arena_alloc(arena *a, uint64_t size) {
+  void *slice = NULL;
+  size = align_up(size, ARENA_ALIGN);
+  if(a->used + size > a->capacity)
+    fatal(E_GENERIC, "%s (capacity: %lu, used: %lu, wanted: %lu)", "The buffer arena is exhausted.", a->capacity, a->used, size);
+  slice = (char *)a->base + a->used;
+  a->used += size;
+  return slice;
+}
+void prefault_region(void *base, uint64_t size, int writable) {
+  // Touch a byte per page so the kernel maps them all now (a write for our own memory, so we get private pages rather
+  // than the shared zero page), then pin them so nothing gets reclaimed between cells.
+  long page = sysconf(_SC_PAGESIZE);
+  volatile char *bytes = base;
+  if(base == NULL || size == 0)
+    return;
+  for(uint64_t offset=0; offset<size; offset+=page) {
+    if(writable)
+      bytes[offset] = bytes[offset];
+    else
+      (void)bytes[offset];
+  }
+  if(mlock(base, size) != 0 && __sync_bool_compare_and_swap(&MLOCK_WARNED, 0, 1))
+    fprintf(status_out, "Note: couldn't mlock() %lu bytes of buffers (%s); raise RLIMIT_MEMLOCK (ulimit -l) to lock them. "
+      "They are still pre-faulted.\n", size, strerror(errno));
+}
+
+
+
+/*
+ *  Cache state at the start of a phase.  By default a phase inherits whatever the previous one left in L2/L3, which
+ *  flatters whichever codec happens to run later over the same blocks.  --cache cold clflushes every line of the
+ *  buffers the phase is about to touch; --cache evict streams a buffer well beyond the last-level cache instead, which
+ *  works on any CPU and also pushes out code and codec state.  (--cache hot is an untimed pass, see prime_phase().)
+ */
+void evict_start() {
+  long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if(CACHE_MODE != CACHE_EVICT)
+    return;
+  if(llc <= 0)
+    llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if(llc <= 0)
+    llc = (long)EVICT_FALLBACK_MB << 20;
+  evict_size = align_up(EVICT_LLC_MULTIPLE * (uint64_t)llc, CACHE_LINE);
+  evict_buffer = mmap(NULL, evict_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(evict_buffer == MAP_FAILED) {
+    evict_buffer = NULL;
+    fatal(E_GENERIC, "%s%lu%s", "Failed to map ", evict_size, " bytes for the cache eviction buffer.");
+  }
+  memset(evict_buffer, 1, evict_size);  // Real pages; the shared zero page would only ever occupy one line per page.
+}
+void evict_stop() {
+  if(evict_buffer != NULL)
+    munmap(evict_buffer, evict_size);
+  evict_buffer = NULL;
+}
+void evict_caches() {
+  volatile uint64_t sink = 0;
+  uint64_t sum = 0;
+  for(uint64_t offset=0; offset<evict_size; offset+=CACHE_LINE)
+    sum += ((unsigned char *)evict_buffer)[offset];
+  sink = sum;
+  (void)sink;
+}
+void flush_lines(void *base, uint64_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+  char *line = (char *)((uintptr_t)base & ~(uintptr_t)(CACHE_LINE - 1));
+  for(; line < (char *)base + size; line += CACHE_LINE)
+    _mm_clflush(line);
+#else
+  (void)base;
+  (void)size;
+#endif
+}
+void chill_phase(buffer *bufs, int64_t s_idx, int64_t e_idx, int direction) {
+  // Only what the phase reads and writes: compression reads raw and fills compressed, decompression the reverse.
+  if(CACHE_MODE == CACHE_EVICT) {
+    evict_caches();
+    return;
+  }
+  for(int64_t i=s_idx; i<=e_idx; i++) {
+    if(direction == PHASE_COMP) {
+      flush_lines(bufs[i].raw, bufs[i].raw_size);
+      flush_lines(bufs[i].compressed, bufs[i].comp_bound);
+    } else {
+      flush_lines(bufs[i].compressed, bufs[i].comp_size);
+      flush_lines(bufs[i].decompressed, bufs[i].raw_size);
+    }
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_mfence();
+#endif
+}
+
+
+
+/*
+ *  Hardware performance counters.  Each pool worker opens one counter group for its own thread (any CPU) when it starts,
+ *  and run_test() resets/enables the group around every phase.  Cycles lead the group so all members are scheduled onto
+ *  the PMU together; events the hardware doesn't have are skipped rather than failing the run.
+ */
+void perf_attr(struct perf_event_attr *attr, int counter) {
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->disabled = (counter == PERF_CYCLES);
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr->type = PERF_TYPE_HARDWARE;
+  switch(counter) {
+    case PERF_CYCLES:        attr->config = PERF_COUNT_HW_CPU_CYCLES;    break;
+    case PERF_INSTRUCTIONS:  attr->config = PERF_COUNT_HW_INSTRUCTIONS;  break;
+    case PERF_LLC_MISSES:    attr->config = PERF_COUNT_HW_CACHE_MISSES;  break;
+    case PERF_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    case PERF_L1D_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_DTLB_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+  }
+}
+void perf_open_thread() {
+  struct perf_event_attr attr;
+  for(int counter=0; counter<PERF_EVENTS; counter++) {
+    perf_attr(&attr, counter);
+    perf_fds[counter] = syscall(__NR_perf_event_open, &attr, 0, -1, counter == PERF_CYCLES ? -1 : perf_fds[PERF_CYCLES], 0);
+    if(perf_fds[PERF_CYCLES] == -1) {
+      // No leader, no group.  Say so once and carry on without counters.
+      if(__sync_bool_compare_and_swap(&PERF_AVAILABLE, 1, 0))
+        fprintf(stderr, "WARNING: hardware counters unavailable (%s); --perf columns will be n/a.\n", strerror(errno));
+      return;
+    }
+    if(perf_fds[counter] == -1)
+      perf_missing[counter] = 1;
+  }
+}
+void perf_close_thread() {
+  for(int counter=0; counter<PERF_EVENTS; counter++) {
+    if(perf_fds[counter] != -1)
+      close(perf_fds[counter]);
+    perf_fds[counter] = -1;
+  }
+}
+static inline void perf_begin() {
+  if(perf_fds[PERF_CYCLES] == -1)
+    return;
+  ioctl(perf_fds[PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perf_fds[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+static inline void perf_end(uint64_t *counters) {
+  // Group read: nr, time_enabled, time_running, then one value per member in the order they joined.
+  uint64_t data[3 + PERF_EVENTS];
+  int member = 0;
+  double scale = 1.0;
+  if(perf_fds[PERF_CYCLES] == -1)
+    return;
+  ioctl(perf_fds[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if(read(perf_fds[PERF_CYCLES], data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)))
+    return;
+  if(data[2] > 0 && data[2] < data[1])
+    scale = (double)data[1] / data[2];
+  for(int counter=0; counter<PERF_EVENTS; counter++) {
+    if(perf_fds[counter] == -1)
+      continue;
+    if((uint64_t)member < data[0])
+      counters[counter] += (uint64_t)(data[3 + member] * scale);
+    member++;
+  }
+}
+
+
+
+/*
+ *  Persistent worker pool.  Threads are created and pinned once in main() so thread startup never lands inside a timed
+ *  phase and the scheduler can't migrate a worker mid-measurement.  pool_run() hands the same job to every worker (each
+ *  gets its own worker_id to pick its share) and returns when all of them are done.
+ */
+void pin_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    fatal(E_GENERIC, "%s%i", "Unable to pin a worker thread to CPU ", cpu);
+}
+void default_cpu_list(int count) {
+  // Without --cpus take the first CPUs this process is allowed to run on, one per worker.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  for(int cpu=0; cpu<CPU_SETSIZE && PIN_CPU_COUNT<count; cpu++) {
+    if(!CPU_ISSET(cpu, &allowed))
+      continue;
+    PIN_CPUS = realloc(PIN_CPUS, (PIN_CPU_COUNT + 1) * sizeof(int));
+    PIN_CPUS[PIN_CPU_COUNT++] = cpu;
+  }
+  if(PIN_CPU_COUNT < count)
+    fatal(E_GENERIC, "%s%i%s", "Only ", PIN_CPU_COUNT, " CPUs are available to pin workers to.");
+}
+void pool_worker(pool_seat *seat) {
+  worker_pool *pool = seat->pool;
+  uint64_t seen = 0;
+  pin_to_cpu(PIN_CPUS[seat->worker_id]);
+  if(PERF_COUNTERS)
+    perf_open_thread();
+  codec_open_states();
+  pthread_mutex_lock(&pool->lock);
+  pool->started++;
+  pthread_cond_broadcast(&pool->job_done);
+  while(1) {
+    while(pool->generation == seen && !pool->shutdown)
+      pthread_cond_wait(&pool->job_ready, &pool->lock);
+    if(pool->shutdown)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+    pool->job(pool->arg, seat->worker_id);
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if(pool->pending == 0)
+      pthread_cond_broadcast(&pool->job_done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  codec_close_states();
+  perf_close_thread();
+  free(seat);
+}
+void pool_start(worker_pool *pool, int size) {
+  pool_seat *seat = NULL;
+  pool->threads = malloc(size * sizeof(pthread_t));
+  if(pool->threads == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the worker pool.");
+  pool->size = size;
+  pool->started = 0;
+  pool->generation = 0;
+  pool->pending = 0;
+  pool->shutdown = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->job_ready, NULL);
+  pthread_cond_init(&pool->job_done, NULL);
+  for(int i=0; i<size; i++) {
+    seat = malloc(sizeof(pool_seat));
+    seat->pool = pool;
+    seat->worker_id = i;
+    pthread_create(&pool->threads[i], NULL, (void *) &pool_worker, seat);
+  }
+  // Don't return until everyone is pinned, so the first job doesn't pay for it.
+  pthread_mutex_lock(&pool->lock);
+  while(pool->started < size)
+    pthread_cond_wait(&pool->job_done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+void pool_run(worker_pool *pool, pool_job job, void *arg) {
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->arg = arg;
+  pool->pending = pool->size;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->job_ready);
+  while(pool->pending > 0)
+    pthread_cond_wait(&pool->job_done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+void pool_stop(worker_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->job_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for(int i=0; i<pool->size; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool->threads);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->job_ready);
+  pthread_cond_destroy(&pool->job_done);
+}
+
+
+
+/*
+ *  Log-bucketed (HDR style) latency histograms.  Values below HIST_SUB_COUNT get exact buckets; above that each power of
+ *  two is split into HIST_SUB_COUNT equal parts, so relative precision is constant from nanoseconds to seconds.
+ */
+int hist_index(uint64_t value) {
+  int exponent = 0;
+  if(value < HIST_SUB_COUNT)
+    return (int)value;
+  exponent = 63 - __builtin_clzll(value);
+  return (exponent - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + (int)((value >> (exponent - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+uint64_t hist_upper_bound(int index) {
+  // Highest value that lands in bucket index.
+  int exponent = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+  uint64_t sub = index % HIST_SUB_COUNT;
+  if(index < HIST_SUB_COUNT)
+    return index;
+  return ((HIST_SUB_COUNT + sub + 1) << (exponent - HIST_SUB_BITS)) - 1;
+}
+void hist_record(histogram *hist, uint64_t value) {
+  hist->buckets[hist_index(value)]++;
+  hist->count++;
+  if(value > hist->max)
+    hist->max = value;
+}
+void hist_merge(histogram *into, histogram *from) {
+  for(int i=0; i<HIST_BUCKETS; i++)
+    into->buckets[i] += from->buckets[i];
+  into->count += from->count;
+  if(from->max > into->max)
+    into->max = from->max;
+}
+uint64_t hist_percentile(histogram *hist, double percentile) {
+  uint64_t target = (uint64_t)(percentile / 100.0 * hist->count + 0.999999);
+  uint64_t seen = 0;
+  if(target == 0)
+    target = 1;
+  for(int i=0; i<HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if(seen >= target)
+      return hist_upper_bound(i) < hist->max ? hist_upper_bound(i) : hist->max;
+  }
+  return hist->max;
+}
+
+
+
+/*
+ *  Robust statistics over repeated trials.  Outliers are rejected with the MAD-based modified z-score (robust against the
+ *  very interrupts and frequency dips we're trying to discard), then the survivors are summarized.
+ */
+const double t_critical_95[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179,
+                                  2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                  2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+int compare_doubles(const void *a, const void *b) {
+  double left = *(const double *)a, right = *(const double *)b;
+  return (left > right) - (left < right);
+}
+double median_of(double *values, int count) {
+  // Sorts in place.
+  qsort(values, count, sizeof(double), compare_doubles);
+  if(count % 2 == 1)
+    return values[count / 2];
+  return (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+void summarize_trials(uint64_t *samples, int count, trial_stats *stats) {
+  double values[count], deviations[count];
+  double median = 0, mad = 0, sum = 0, squares = 0;
+  for(int i=0; i<count; i++)
+    values[i] = (double)samples[i];
+  median = median_of(values, count);
+  for(int i=0; i<count; i++)
+    deviations[i] = values[i] > median ? values[i] - median : median - values[i];
+  mad = median_of(deviations, count);
+
+  // Keep anything within OUTLIER_Z; values[] is sorted, so compact it in place.  A zero MAD (most trials identical)
+  // would make every other trial infinitely far out, so reject nothing in that case.
+  stats->kept = 0;
+  for(int i=0; i<count; i++) {
+    if(count >= OUTLIER_MIN_TRIALS && mad > 0 && 0.6745 * (values[i] > median ? values[i] - median : median - values[i]) / mad > OUTLIER_Z)
+      continue;
+    values[stats->kept++] = values[i];
+  }
+  stats->rejected = count - stats->kept;
+  for(int i=0; i<stats->kept; i++)
+    sum += values[i];
+  stats->mean = sum / stats->kept;
+  for(int i=0; i<stats->kept; i++)
+    squares += (values[i] - stats->mean) * (values[i] - stats->mean);
+  stats->stddev = stats->kept > 1 ? sqrt(squares / (stats->kept - 1)) : 0;
+  stats->min = values[0];
+  stats->median = median_of(values, stats->kept);
+  stats->ci95 = 0;
+  if(stats->kept > 1)
+    stats->ci95 = (stats->kept - 1 <= 30 ? t_critical_95[stats->kept - 2] : 1.96) * stats->stddev / sqrt(stats->kept);
+}
+
+
+
+/*
+ *  Print a table entry, header, or etc.
+ */
+const int fields[4] = {16, 10, 10, 8};  // File, size, block size, blocks.  Then three groups of one column per codec.
+#define CODEC_FIELD          9
+#define GROUP_MIN_WIDTH     32   // Wide enough for the group titles (and the notes) with only a codec or two.
+#define SWEEP_WIDTH         96   // --sweep swaps the three codec groups for one line per configuration.
+#define SWEEP_NAME          12
+char *hyphens = "----------------------------------------------------------------------------------------------------";
+char *blank = "                                                                                                  ";
+char *group_titles[3] = {"Compression Size (KiB)", "Compression Time (uS)", "Decompression Time (uS)"};
+uint64_t to_kib(uint64_t value) {
+  return value / 1024;
+}
+int ns_to_ms(uint64_t value) {
+  return (int)(value / MILLION);
+}
+int ns_to_us(uint64_t value) {
+  return (int)(value / THOUSAND);
+}
+int group_count() {
+  return SWEEP ? 1 : 3;
+}
+int group_width() {
+  if(SWEEP)
+    return SWEEP_WIDTH;
+  return CODEC_COUNT * CODEC_FIELD > GROUP_MIN_WIDTH ? CODEC_COUNT * CODEC_FIELD : GROUP_MIN_WIDTH;
+}
+int table_width() {
+  // Every column is padded by 2 and closed by a border, plus the leading border.
+  int width = 1 + (4 + group_count()) * 3 + group_count() * group_width();
+  for(int i=0; i<4; i++)
+    width += fields[i];
+  return width;
+}
+void print_fill(char *fill, int width) {
+  for(int i=0; i<width; i++)
+    putchar(fill[0]);
+}
+void print_separator(char *column, char *fill) {
+  if(OUTPUT_FORMAT != FORMAT_TABLE)
+    return;
+  // Note: we +2 to complement padding of strings/values.
+  for(int i=0; i<4; i++) {
+    printf("%1s", column);
+    print_fill(fill, fields[i] + 2);
+  }
+  for(int group=0; group<group_count(); group++) {
+    printf("%1s", column);
+    print_fill(fill, group_width() + 2);
+  }
+  printf("%1s\n", column);
+}
+void emit_metadata();
+void print_header() {
+  char text[128];
+  if(OUTPUT_FORMAT != FORMAT_TABLE) {
+    emit_metadata();
+    return;
+  }
+  printf("Threading Mode: %s", THREADS > 1 ? "Multi-Threaded" : "Single-Threaded");
+  if(THREADS > 1)
+    printf("  (%i threads)", THREADS);
+  if(STREAM_DEPTH > 0)
+    printf("  Streaming (ring depth %i)", STREAM_DEPTH);
+  if(CELL_PARALLEL)
+    printf("  Cell-parallel");
+  if(SYNC_PHASES)
+    printf("  Phase-synchronized");
+  if(CACHE_MODE != CACHE_AS_IS)
+    printf("  Cache: %s", cache_names[CACHE_MODE]);
+  if(SHUFFLE_CODECS)
+    printf("  Shuffled codecs (seed %u)", SHUFFLE_SEED);
+  printf("  Pinned CPUs: ");
+  for(int i=0; i<THREADS; i++)
+    printf("%s%i", i > 0 ? "," : "", PIN_CPUS[i]);
+  printf("\n");
+  print_separator("+", hyphens);
+  printf("| %-*.*s | %*.*s | %*.*s | %*.*s |",
+    fields[0], fields[0], "Data File",
+    fields[1], fields[1], "Size (KiB)",
+    fields[2], fields[2], "Block Size",
+    fields[3], fields[3], "Blocks"
+  );
+  if(SWEEP) {
+    snprintf(text, sizeof(text), "%-*s %8s %11s %12s %12s  %s", SWEEP_NAME, "Codec", "Ratio", "Comp MB/s", "Decomp MB/s",
+      "Size (KiB)", "Pareto");
+    printf(" %-*.*s |", group_width(), group_width(), text);
+  }
+  for(int group=0; group<group_count() && !SWEEP; group++)
+    printf(" %-*.*s |", group_width(), group_width(), group_titles[group]);
+  printf("\n| %*.*s | %*.*s | %*.*s | %*.*s |",
+    fields[0], fields[0], blank,
+    fields[1], fields[1], "(2^10)",
+    fields[2], fields[2], blank,
+    fields[3], fields[3], blank
+  );
+  if(SWEEP)
+    printf(" %-*.*s |", group_width(), group_width(), "(MB/s is decimal megabytes of input per second)");
+  for(int group=0; group<group_count() && !SWEEP; group++) {
+    printf(" ");
+    for(int id=0; id<CODEC_COUNT; id++)
+      printf("%*.*s", CODEC_FIELD, CODEC_FIELD - 1, codecs[id].label);
+    printf("%*s |", group_width() - CODEC_COUNT * CODEC_FIELD, "");
+  }
+  printf("\n");
+  print_separator("+", hyphens);
+}
+void print_note(char *format, ...) {
+  // Free-form line that still lines up with the table borders; used for per-worker breakdowns under a row.
+  char text[512];
+  va_list list;
+  if(OUTPUT_FORMAT != FORMAT_TABLE)
+    return;
+  va_start(list, format);
+  vsnprintf(text, sizeof(text), format, list);
+  va_end(list);
+  printf("| %-*.*s |\n", table_width() - 4, table_width() - 4, text);
+}
+void codec_rates(result *res, int id, double rates[3]) {
+  // Ratio, compress MB/s and decompress MB/s; MB/s is decimal megabytes of input per second, i.e. bytes/ns * 1000.
+  codec_result *cr = &res->codecs[id];
+  rates[0] = cr->comp_size > 0 ? (double)res->raw_size / cr->comp_size : 0;
+  rates[1] = cr->comp_time > 0 ? (double)res->raw_size * THOUSAND / cr->comp_time : 0;
+  rates[2] = cr->decomp_time > 0 ? (double)res->raw_size * THOUSAND / cr->decomp_time : 0;
+}
+void emit_delta(result *res, int id, int other, double rates[3], double base[3]);
+void print_variant_deltas(result *res) {
+  // Throughput of each variant relative to its baseline in the same cell (or the same block size, for totals).
+  double rates[3], base[3];
+  int other = -1;
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if((other = codec_baseline(id)) == -1)
+      continue;
+    codec_rates(res, id, rates);
+    codec_rates(res, other, base);
+    if(OUTPUT_FORMAT != FORMAT_TABLE) {
+      emit_delta(res, id, other, rates, base);
+      continue;
+    }
+    print_note("  %-12s vs %-12s ratio %7.3f vs %7.3f  comp %+7.1f%% (%9.1f vs %9.1f MB/s)  decomp %+7.1f%% (%9.1f vs "
+      "%9.1f MB/s)", codecs[id].name, codecs[other].name, rates[0], base[0],
+      base[1] > 0 ? 100.0 * (rates[1] / base[1] - 1) : 0, rates[1], base[1],
+      base[2] > 0 ? 100.0 * (rates[2] / base[2] - 1) : 0, rates[2], base[2]);
+  }
+}
+void pareto_frontier(result *res, int frontier[]) {
+  // A configuration is on the frontier unless another is at least as good on ratio, compress and decompress speed, and
+  // strictly better on at least one of them.  Quadratic, but there are only ever a few dozen.
+  double rates[MAX_CODECS][3];
+  int no_worse = 0, better = 0;
+  for(int id=0; id<CODEC_COUNT; id++)
+    codec_rates(res, id, rates[id]);
+  for(int id=0; id<CODEC_COUNT; id++) {
+    frontier[id] = 1;
+    for(int other=0; other<CODEC_COUNT && frontier[id]; other++) {
+      no_worse = 1;
+      better = 0;
+      for(int axis=0; axis<3; axis++) {
+        no_worse &= rates[other][axis] >= rates[id][axis];
+        better |= rates[other][axis] > rates[id][axis];
+      }
+      if(no_worse && better)
+        frontier[id] = 0;
+    }
+  }
+}
+void print_sweep_rows(char *label, result *res) {
+  // One line per configuration; the cell's own columns only on the first.
+  char text[128];
+  double rates[3];
+  int frontier[MAX_CODECS];
+  pareto_frontier(res, frontier);
+  for(int id=0; id<CODEC_COUNT; id++) {
+    codec_rates(res, id, rates);
+    if(id == 0)
+      printf("| %-*.*s | %*lu | %*lu | %*lu |", fields[0], fields[0], label, fields[1], to_kib(res->raw_size),
+        fields[2], res->block_size, fields[3], res->blocks);
+    else
+      printf("| %*.*s | %*.*s | %*.*s | %*.*s |", fields[0], fields[0], blank, fields[1], fields[1], blank,
+        fields[2], fields[2], blank, fields[3], fields[3], blank);
+    snprintf(text, sizeof(text), "%-*.*s %8.3f %11.1f %12.1f %12lu  %s", SWEEP_NAME, SWEEP_NAME, codecs[id].name, rates[0],
+      rates[1], rates[2], to_kib(res->codecs[id].comp_size), frontier[id] ? "*" : "");
+    printf(" %-*.*s |\n", group_width(), group_width(), text);
+  }
+}
+void print_row(char *label, result *res) {
+  codec_result *cr = NULL;
+  if(OUTPUT_FORMAT != FORMAT_TABLE)
+    return;
+  if(SWEEP) {
+    print_sweep_rows(label, res);
+    return;
+  }
+  printf("| %-*.*s | %*lu | %*lu | %*lu |",
+    fields[0], fields[0], label,
+    fields[1], to_kib(res->raw_size),
+    fields[2], res->block_size,
+    fields[3], res->blocks
+  );
+  for(int group=0; group<3; group++) {
+    printf(" ");
+    for(int id=0; id<CODEC_COUNT; id++) {
+      cr = &res->codecs[id];
+      if(group == 0)
+        printf("%*lu", CODEC_FIELD, to_kib(cr->comp_size));
+      else
+        printf("%*i", CODEC_FIELD, ns_to_us(group == 1 ? cr->comp_time : cr->decomp_time));
+    }
+    printf("%*s |", group_width() - CODEC_COUNT * CODEC_FIELD, "");
+  }
+  printf("\n");
+}
+void emit_record(result *res);
+void print_result(result *res) {
+  if(OUTPUT_FORMAT != FORMAT_TABLE) {
+    emit_record(res);
+    return;
+  }
+  // Same-named files from different subfolders need their folders to tell them apart; keep the tail if it's too long.
+  char label[fields[0] + 1];
+  char *name = res->src->name;
+  if(strlen(name) > (size_t)fields[0]) {
+    snprintf(label, sizeof(label), "...%s", name + strlen(name) - (fields[0] - 3));
+    name = label;
+  }
+  print_row(name, res);
+}
+void phase_label(int phase, char *label, int length) {
+  snprintf(label, length, "%s %s", codecs[phase / DIRECTIONS].name, direction_names[phase % DIRECTIONS]);
+}
+void emit_detail(char *type, result *res, int phase, int count, char *keys[], double values[]);
+void print_latency(result *res) {
+  histogram *hist = NULL;
+  char label[48];
+  char *keys[5] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns"};
+  double values[5];
+  if(res->latency == NULL)
+    return;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    hist = &res->latency[phase];
+    if(OUTPUT_FORMAT != FORMAT_TABLE) {
+      values[0] = hist_percentile(hist, 50.0);
+      values[1] = hist_percentile(hist, 90.0);
+      values[2] = hist_percentile(hist, 99.0);
+      values[3] = hist_percentile(hist, 99.9);
+      values[4] = hist->max;
+      emit_detail("latency", res, phase, 5, keys, values);
+      continue;
+    }
+    phase_label(phase, label, sizeof(label));
+    print_note("  %-14s latency (ns):  p50 %'10lu  p90 %'10lu  p99 %'10lu  p99.9 %'10lu  max %'10lu", label,
+      hist_percentile(hist, 50.0), hist_percentile(hist, 90.0), hist_percentile(hist, 99.0), hist_percentile(hist, 99.9),
+      hist->max);
+  }
+}
+void print_trial_stats(result *res, trial_stats stats[]) {
+  char label[48];
+  char *keys[7] = {"trials", "rejected", "median_ns", "mean_ns", "stddev_ns", "min_ns", "ci95_ns"};
+  double values[7];
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    if(OUTPUT_FORMAT != FORMAT_TABLE) {
+      values[0] = stats[phase].kept + stats[phase].rejected;
+      values[1] = stats[phase].rejected;
+      values[2] = stats[phase].median;
+      values[3] = stats[phase].mean;
+      values[4] = stats[phase].stddev;
+      values[5] = stats[phase].min;
+      values[6] = stats[phase].ci95;
+      emit_detail("trials", res, phase, 7, keys, values);
+      continue;
+    }
+    phase_label(phase, label, sizeof(label));
+    print_note("  %-14s trials %4i (%i out): median %'12.1f  mean %'12.1f  sd %'10.1f  min %'12.1f  95%% CI +/- %'9.1f uS",
+      label, stats[phase].kept + stats[phase].rejected, stats[phase].rejected, stats[phase].median / THOUSAND,
+      stats[phase].mean / THOUSAND, stats[phase].stddev / THOUSAND, stats[phase].min / THOUSAND,
+      stats[phase].ci95 / THOUSAND);
+  }
+}
+void print_counters(result *res) {
+  // Everything per input byte.  Counters that never opened show as n/a rather than a misleading zero (and are left out of
+  // csv/json records altogether).
+  char text[PERF_EVENTS][32];
+  char label[48];
+  char *keys[PERF_EVENTS];
+  double values[PERF_EVENTS];
+  char *perf_keys[PERF_EVENTS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses"};
+  int count = 0;
+  uint64_t *counters = NULL;
+  double bytes = res->raw_size > 0 ? (double)res->raw_size : 1.0;
+  if(!PERF_COUNTERS)
+    return;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    counters = res->codecs[phase / DIRECTIONS].counters[phase % DIRECTIONS];
+    count = 0;
+    for(int counter=0; counter<PERF_EVENTS; counter++) {
+      if(!PERF_AVAILABLE || perf_missing[counter] || counters[PERF_CYCLES] == 0) {
+        snprintf(text[counter], sizeof(text[counter]), "%s %8s", perf_names[counter], "n/a");
+        continue;
+      }
+      snprintf(text[counter], sizeof(text[counter]), "%s %8.4f", perf_names[counter], counters[counter] / bytes);
+      keys[count] = perf_keys[counter];
+      values[count++] = counters[counter];
+    }
+    if(OUTPUT_FORMAT != FORMAT_TABLE) {
+      emit_detail("counters", res, phase, count, keys, values);
+      continue;
+    }
+    phase_label(phase, label, sizeof(label));
+    print_note("  %-14s per byte: %s  %s  %s  %s  %s  %s", label, text[0], text[1], text[2], text[3], text[4], text[5]);
+  }
+}
+uint64_t *phase_time(result *res, int phase);
+void print_cpu_costs(result *res) {
+  // CPU ns per input byte is CPU seconds per (decimal) GB.  Efficiency compares that CPU time with the wall time the
+  // workers were given for the phase: first worker in to last worker out, for every worker that could have run it.  CPU
+  // and wall are both trial means (the phase columns are medians).  Work-stealing chunks compress and then decompress,
+  // so their directions overlap; those codecs get one more line over both directions, from the codec's window.  Streamed
+  // blocks run every codec back to back, so nothing there has a wall time of its own.
+  char label[48];
+  codec_result *cr = NULL;
+  uint64_t cpu = 0, wall = 0;
+  int lanes = CELL_PARALLEL ? 1 : THREADS;
+  if(!REPORT_CPU)
+    return;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    cr = &res->codecs[phase / DIRECTIONS];
+    cpu = cr->cpu_time[phase % DIRECTIONS];
+    wall = cr->phase_wall[phase % DIRECTIONS];
+    phase_label(phase, label, sizeof(label));
+    if(wall > 0)
+      print_note("  %-14s cpu %'9.3f s/GB  wall %'9.3f s/GB  parallel efficiency %6.1f%%", label,
+        res->raw_size > 0 ? (double)cpu / res->raw_size : 0.0, res->raw_size > 0 ? (double)wall / res->raw_size : 0.0,
+        100.0 * cpu / ((double)wall * lanes));
+    else
+      print_note("  %-14s cpu %'9.3f s/GB  wall       n/a        parallel efficiency    n/a", label,
+        res->raw_size > 0 ? (double)cpu / res->raw_size : 0.0);
+    if(phase % DIRECTIONS != PHASE_DECOMP || wall > 0 || cr->codec_wall == 0)
+      continue;
+    cpu = cr->cpu_time[PHASE_COMP] + cr->cpu_time[PHASE_DECOMP];
+    snprintf(label, sizeof(label), "%s both", codecs[phase / DIRECTIONS].name);
+    print_note("  %-14s cpu %'9.3f s/GB  wall %'9.3f s/GB  parallel efficiency %6.1f%%", label,
+      res->raw_size > 0 ? (double)cpu / res->raw_size : 0.0, res->raw_size > 0 ? (double)cr->codec_wall / res->raw_size : 0.0,
+      100.0 * cpu / ((double)cr->codec_wall * lanes));
+  }
+}
+void print_faults(result *res) {
+  char label[48];
+  uint64_t *faults = NULL;
+  if(!REPORT_FAULTS)
+    return;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    faults = res->codecs[phase / DIRECTIONS].faults;
+    phase_label(phase, label, sizeof(label));
+    print_note("  %-14s page faults: %'10lu  (%.3f per block)", label, faults[phase % DIRECTIONS],
+      res->blocks > 0 ? (double)faults[phase % DIRECTIONS] / res->blocks : 0.0);
+  }
+}
+void print_cell_times(result *res, int trials) {
+  // The whole cell's wall clock and every worker's CPU time, summed over its trials (0 trials: a streamed cell's one pass).
+  char *keys[3] = {"wall_ns", "cpu_ns", "trials"};
+  double values[3] = {res->wall_time, res->cpu_time, trials > 0 ? trials : 1};
+  if(OUTPUT_FORMAT != FORMAT_TABLE)
+    emit_detail("cell_time", res, -1, 3, keys, values);
+  else if(trials > 0)
+    print_note("  cell: wall %'i uS  cpu %'i uS over %i trial(s)", ns_to_us(res->wall_time), ns_to_us(res->cpu_time), trials);
+  else
+    print_note("  cell: wall %'i uS  cpu %'i uS", ns_to_us(res->wall_time), ns_to_us(res->cpu_time));
+}
+void emit_frontier(result *total);
+void print_frontier(result *total) {
+  // The cross-file summary for one block size: frontier members only, densest first.
+  int frontier[MAX_CODECS], order[MAX_CODECS];
+  int members = 0;
+  double rates[3], other[3];
+  if(OUTPUT_FORMAT != FORMAT_TABLE) {
+    emit_frontier(total);
+    return;
+  }
+  pareto_frontier(total, frontier);
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(!frontier[id])
+      continue;
+    codec_rates(total, id, rates);
+    order[members] = id;
+    for(int i=members; i>0; i--) {
+      codec_rates(total, order[i - 1], other);
+      if(other[0] >= rates[0])
+        break;
+      order[i] = order[i - 1];
+      order[i - 1] = id;
+    }
+    members++;
+  }
+  if(total->block_size == 0)
+    print_note("Pareto frontier for whole-file blocks, all files (%'lu KiB): %i of %i configurations",
+      to_kib(total->raw_size), members, CODEC_COUNT);
+  else
+    print_note("Pareto frontier for %'lu byte blocks, all files (%'lu KiB): %i of %i configurations", total->block_size,
+      to_kib(total->raw_size), members, CODEC_COUNT);
+  for(int i=0; i<members; i++) {
+    codec_rates(total, order[i], rates);
+    print_note("  %-*s ratio %8.3f   comp %'10.1f MB/s   decomp %'10.1f MB/s", SWEEP_NAME, codecs[order[i]].name, rates[0],
+      rates[1], rates[2]);
+  }
+}
+void print_reuse_summary(result *total) {
+  // The per-block-size answer to "what do reused contexts buy us": the deltas over every file's cells combined.
+  if(total->block_size == 0)
+    print_note("Context reuse for whole-file blocks, all files (%'lu KiB):", to_kib(total->raw_size));
+  else
+    print_note("Context reuse for %'lu byte blocks, all files (%'lu KiB):", total->block_size, to_kib(total->raw_size));
+  print_variant_deltas(total);
+}
+void print_worker_result(int worker_id, result *res) {
+  char label[32];
+  char *keys[5] = {"worker", "blocks", "raw_bytes", "comp_bytes", "ns"};
+  double values[5];
+  if(OUTPUT_FORMAT != FORMAT_TABLE) {
+    for(int phase=0; phase<PHASE_COUNT; phase++) {
+      values[0] = worker_id;
+      values[1] = res->blocks;
+      values[2] = res->raw_size;
+      values[3] = res->codecs[phase / DIRECTIONS].comp_size;
+      values[4] = *phase_time(res, phase);
+      emit_detail("worker_phase", res, phase, 5, keys, values);
+    }
+    return;
+  }
+  snprintf(label, sizeof(label), "  worker %i", worker_id);
+  print_row(label, res);
+}
+
+
+
+/*
+ *  Structured output (CSV / JSON lines).  One record per cell and codec with full-precision nanoseconds and bytes; the
+ *  table's KiB and uS columns are just for eyeballing.  Metadata goes first: CSV gets "# key=value" comment lines,
+ *  JSON gets a {"type":"metadata"} record.  Everything else the table prints under a row goes through emit_detail().
+ */
+void cpu_model(char *model, int length) {
+  char line[512];
+  char *colon = NULL;
+  FILE *fh = fopen("/proc/cpuinfo", "r");
+  snprintf(model, length, "%s", "unknown");
+  if(fh == NULL)
+    return;
+  while(fgets(line, sizeof(line), fh) != NULL) {
+    if(strncmp(line, "model name", 10) != 0 || (colon = strchr(line, ':')) == NULL)
+      continue;
+    snprintf(model, length, "%s", colon + 2);
+    model[strcspn(model, "\n")] = '\0';
+    break;
+  }
+  fclose(fh);
+}
+void emit_string(char *value) {
+  // Quoted and escaped for whichever format is active; file names are user input after all.
+  putchar('"');
+  for(char *c=value; *c!='\0'; c++) {
+    if(OUTPUT_FORMAT == FORMAT_CSV && *c == '"')
+      printf("\"\"");
+    else if(OUTPUT_FORMAT == FORMAT_JSON && (*c == '"' || *c == '\\'))
+      printf("\\%c", *c);
+    else if(OUTPUT_FORMAT == FORMAT_JSON && (unsigned char)*c < 0x20)
+      printf("\\u%04x", *c);
+    else
+      putchar(*c);
+  }
+  putchar('"');
+}
+void emit_metadata() {
+  char model[256];
+  char versions[3][32];
+  char *keys[16] = {"cpu_model", "cpu_count", "threads", "pinned_cpus", "lz4_version", "zlib_version", "zstd_version",
+                    "ingest", "min_trials", "codecs", "schedule", "dict_bytes", "dict_build_ns", "cache", "codec_order",
+                    "min_time_ms"};
+  char values[16][256];
+  char *text[16];
+  char *cpus = NULL, *names = NULL;
+  uint64_t length = 1;
+  cpu_model(model, sizeof(model));
+  snprintf(versions[0], sizeof(versions[0]), "%i", LZ4_versionNumber());
+  snprintf(versions[1], sizeof(versions[1]), "%s", zlibVersion());
+  snprintf(versions[2], sizeof(versions[2]), "%u", ZSTD_versionNumber());
+  snprintf(values[0], sizeof(values[0]), "%s", model);
+  snprintf(values[1], sizeof(values[1]), "%i", CPU_COUNT);
+  snprintf(values[2], sizeof(values[2]), "%i", THREADS);
+  snprintf(values[4], sizeof(values[4]), "%s", versions[0]);
+  snprintf(values[5], sizeof(values[5]), "%s", versions[1]);
+  snprintf(values[6], sizeof(values[6]), "%s", versions[2]);
+  snprintf(values[7], sizeof(values[7]), "%s", STREAM_DEPTH > 0 ? "stream" : (MMAP_FILES ? "mmap" : "slurp"));
+  snprintf(values[8], sizeof(values[8]), "%i", TRIALS);
+  snprintf(values[10], sizeof(values[10]), "%s", CELL_PARALLEL ? "cells" : (SYNC_PHASES ? "phases" : "blocks"));
+  snprintf(values[11], sizeof(values[11]), "%lu", corpus_dict.size);
+  snprintf(values[12], sizeof(values[12]), "%lu", corpus_dict.build_time + corpus_dict.prepare_time);
+  snprintf(values[13], sizeof(values[13]), "%s", cache_names[CACHE_MODE]);
+  if(SHUFFLE_CODECS)
+    snprintf(values[14], sizeof(values[14]), "shuffled:%u", SHUFFLE_SEED);
+  else
+    snprintf(values[14], sizeof(values[14]), "%s", "fixed");
+  snprintf(values[15], sizeof(values[15]), "%i", MIN_TIME_MS);
+  // The CPU and codec lists grow with the machine and --sweep, so they get buffers of their own size.
+  for(int id=0; id<CODEC_COUNT; id++)
+    length += strlen(codecs[id].name) + 1;
+  cpus = calloc(THREADS * 12 + 1, 1);
+  names = calloc(length, 1);
+  if(cpus == NULL || names == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the metadata lists.");
+  for(int i=0; i<THREADS; i++)
+    sprintf(cpus + strlen(cpus), "%s%i", i > 0 ? "," : "", PIN_CPUS[i]);
+  for(int id=0; id<CODEC_COUNT; id++)
+    sprintf(names + strlen(names), "%s%s", id > 0 ? "," : "", codecs[id].name);
+  for(int i=0; i<16; i++)
+    text[i] = values[i];
+  text[3] = cpus;
+  text[9] = names;
+  if(OUTPUT_FORMAT == FORMAT_CSV) {
+    for(int i=0; i<16; i++)
+      printf("# %s=%s\n", keys[i], text[i]);
+    printf("file,file_size,block_size,blocks,threads,codec,raw_bytes,comp_bytes,comp_ns,decomp_ns,ratio,comp_mb_s,decomp_mb_s,"
+      "cell_wall_ns,cell_cpu_ns,comp_faults,decomp_faults,comp_cpu_ns,decomp_cpu_ns,comp_wall_ns,decomp_wall_ns,codec_wall_ns,trials\n");
+    free(cpus);
+    free(names);
+    return;
+  }
+  printf("{\"type\":\"metadata\"");
+  for(int i=0; i<16; i++) {
+    printf(",\"%s\":", keys[i]);
+    emit_string(text[i]);
+  }
+  printf("}\n");
+  free(cpus);
+  free(names);
+}
+void emit_record(result *res) {
+  codec_result *cr = NULL;
+  double rates[3];
+  for(int id=0; id<CODEC_COUNT; id++) {
+    cr = &res->codecs[id];
+    codec_rates(res, id, rates);
+    if(OUTPUT_FORMAT == FORMAT_CSV) {
+      emit_string(res->src->filespec);
+      printf(",%lu,%lu,%lu,%i,%s,%lu,%lu,%lu,%lu,%.6f,%.3f,%.3f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%i\n", res->src->size,
+        res->block_size, res->blocks, THREADS, codecs[id].name, res->raw_size, cr->comp_size, cr->comp_time, cr->decomp_time,
+        rates[0], rates[1], rates[2], res->wall_time, res->cpu_time, cr->faults[PHASE_COMP], cr->faults[PHASE_DECOMP],
+        cr->cpu_time[PHASE_COMP], cr->cpu_time[PHASE_DECOMP], cr->phase_wall[PHASE_COMP], cr->phase_wall[PHASE_DECOMP],
+        cr->codec_wall, res->trials);
+      continue;
+    }
+    printf("{\"type\":\"cell\",\"file\":");
+    emit_string(res->src->filespec);
+    printf(",\"file_size\":%lu,\"block_size\":%lu,\"blocks\":%lu,\"threads\":%i,\"codec\":\"%s\",\"raw_bytes\":%lu,"
+      "\"comp_bytes\":%lu,\"comp_ns\":%lu,\"decomp_ns\":%lu,\"ratio\":%.6f,\"comp_mb_s\":%.3f,\"decomp_mb_s\":%.3f,"
+      "\"cell_wall_ns\":%lu,\"cell_cpu_ns\":%lu,\"comp_faults\":%lu,\"decomp_faults\":%lu,\"comp_cpu_ns\":%lu,"
+      "\"decomp_cpu_ns\":%lu,\"comp_wall_ns\":%lu,\"decomp_wall_ns\":%lu,\"codec_wall_ns\":%lu,\"trials\":%i}\n",
+      res->src->size, res->block_size, res->blocks, THREADS, codecs[id].name, res->raw_size, cr->comp_size,
+      cr->comp_time, cr->decomp_time, rates[0], rates[1], rates[2], res->wall_time, res->cpu_time, cr->faults[PHASE_COMP],
+      cr->faults[PHASE_DECOMP], cr->cpu_time[PHASE_COMP], cr->cpu_time[PHASE_DECOMP], cr->phase_wall[PHASE_COMP],
+      cr->phase_wall[PHASE_DECOMP], cr->codec_wall, res->trials);
+  }
+}
+void emit_detail(char *type, result *res, int phase, int count, char *keys[], double values[]) {
+  // The csv/json side of print_note(): whatever a table shows under a row.  Like the frontier, CSV gets these as comment
+  // lines so its one schema holds; JSON gets records of the given type.  phase -1 is for records about no one codec, and
+  // totals across files have no file.  %.15g keeps integer counts exact and fractions short.
+  if(OUTPUT_FORMAT == FORMAT_CSV) {
+    printf("# %s", type);
+    if(res->src != NULL) {
+      printf(" file=");
+      emit_string(res->src->filespec);
+    }
+    printf(" block_size=%lu", res->block_size);
+    if(phase >= 0)
+      printf(" codec=%s direction=%s", codecs[phase / DIRECTIONS].name, direction_names[phase % DIRECTIONS]);
+    for(int i=0; i<count; i++)
+      printf(" %s=%.15g", keys[i], values[i]);
+    printf("\n");
+    return;
+  }
+  printf("{\"type\":\"%s\"", type);
+  if(res->src != NULL) {
+    printf(",\"file\":");
+    emit_string(res->src->filespec);
+  }
+  printf(",\"block_size\":%lu", res->block_size);
+  if(phase >= 0)
+    printf(",\"codec\":\"%s\",\"direction\":\"%s\"", codecs[phase / DIRECTIONS].name, direction_names[phase % DIRECTIONS]);
+  for(int i=0; i<count; i++)
+    printf(",\"%s\":%.15g", keys[i], values[i]);
+  printf("}\n");
+}
+void emit_delta(result *res, int id, int other, double rates[3], double base[3]) {
+  // One variant against its baseline codec.  Cells carry their file; the per-block-size totals behind the context reuse
+  // summary don't, which is how they're told apart.  The _pct fields are the throughput change over the baseline.
+  double comp_pct = base[1] > 0 ? 100.0 * (rates[1] / base[1] - 1) : 0;
+  double decomp_pct = base[2] > 0 ? 100.0 * (rates[2] / base[2] - 1) : 0;
+  if(OUTPUT_FORMAT == FORMAT_CSV) {
+    printf("# delta");
+    if(res->src != NULL) {
+      printf(" file=");
+      emit_string(res->src->filespec);
+    }
+    printf(" block_size=%lu codec=%s baseline=%s raw_bytes=%lu ratio=%.6f baseline_ratio=%.6f comp_mb_s=%.3f "
+      "baseline_comp_mb_s=%.3f comp_pct=%.3f decomp_mb_s=%.3f baseline_decomp_mb_s=%.3f decomp_pct=%.3f\n",
+      res->block_size, codecs[id].name, codecs[other].name, res->raw_size, rates[0], base[0], rates[1], base[1], comp_pct,
+      rates[2], base[2], decomp_pct);
+    return;
+  }
+  printf("{\"type\":\"delta\"");
+  if(res->src != NULL) {
+    printf(",\"file\":");
+    emit_string(res->src->filespec);
+  }
+  printf(",\"block_size\":%lu,\"threads\":%i,\"codec\":\"%s\",\"baseline\":\"%s\",\"raw_bytes\":%lu,\"ratio\":%.6f,"
+    "\"baseline_ratio\":%.6f,\"comp_mb_s\":%.3f,\"baseline_comp_mb_s\":%.3f,\"comp_pct\":%.3f,\"decomp_mb_s\":%.3f,"
+    "\"baseline_decomp_mb_s\":%.3f,\"decomp_pct\":%.3f}\n", res->block_size, THREADS, codecs[id].name, codecs[other].name,
+    res->raw_size, rates[0], base[0], rates[1], base[1], comp_pct, rates[2], base[2], decomp_pct);
+}
+void emit_frontier(result *total) {
+  // CSV keeps its single schema, so the frontier rides along as trailing comment lines.  block_size 0 is whole-file.
+  int frontier[MAX_CODECS];
+  double rates[3];
+  pareto_frontier(total, frontier);
+  for(int id=0; id<CODEC_COUNT; id++) {
+    if(!frontier[id])
+      continue;
+    codec_rates(total, id, rates);
+    if(OUTPUT_FORMAT == FORMAT_CSV) {
+      printf("# pareto block_size=%lu codec=%s raw_bytes=%lu comp_bytes=%lu comp_ns=%lu decomp_ns=%lu ratio=%.6f "
+        "comp_mb_s=%.3f decomp_mb_s=%.3f\n", total->block_size, codecs[id].name, total->raw_size,
+        total->codecs[id].comp_size, total->codecs[id].comp_time, total->codecs[id].decomp_time, rates[0], rates[1],
+        rates[2]);
+      continue;
+    }
+    printf("{\"type\":\"pareto\",\"block_size\":%lu,\"threads\":%i,\"codec\":\"%s\",\"raw_bytes\":%lu,\"comp_bytes\":%lu,"
+      "\"comp_ns\":%lu,\"decomp_ns\":%lu,\"ratio\":%.6f,\"comp_mb_s\":%.3f,\"decomp_mb_s\":%.3f}\n", total->block_size,
+      THREADS, codecs[id].name, total->raw_size, total->codecs[id].comp_size, total->codecs[id].comp_time,
+      total->codecs[id].decomp_time, rates[0], rates[1], rates[2]);
+  }
+}
+
+
+
+/*
+ *  Compression test on a slurped file with a given block size.
+ */
+uint64_t *phase_time(result *res, int phase) {
+  codec_result *cr = &res->codecs[phase / DIRECTIONS];
+  return phase % DIRECTIONS == PHASE_COMP ? &cr->comp_time : &cr->decomp_time;
+}
+void clear_result_values(result *res) {
+  if(res->latency != NULL)
+    memset(res->latency, 0, PHASE_COUNT * sizeof(histogram));
+  memset(res->codecs, 0, CODEC_COUNT * sizeof(codec_result));
+  res->blocks = 0;
+  res->raw_size = 0;
+  res->wall_time = 0;
+  res->cpu_time = 0;
+  res->trials = 1;
+}
+void init_result(result *res, src_file *src, uint64_t block_size) {
+  res->src = src;
+  res->block_size = block_size;
+  res->latency = NULL;
+  clear_result_values(res);
+}
+void track_latency(result *res) {
+  // Histograms are ~8 KiB apiece, so only the results that are actually reported get them.
+  res->latency = calloc(PHASE_COUNT, sizeof(histogram));
+  if(res->latency == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate latency histograms.");
+}
+void free_result(result *res) {
+  free(res->latency);
+  res->latency = NULL;
+}
+void record_block_latency(result *res, result *block) {
+  // For results that already cover exactly one block (streaming), the phase totals are the per-block latencies.
+  for(int phase=0; phase<PHASE_COUNT; phase++)
+    hist_record(&res->latency[phase], *phase_time(block, phase));
+}
+static inline void block_start(histogram *latency, struct timespec *start) {
+  if(latency != NULL)
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+static inline void block_end(histogram *latency, int phase, struct timespec *start) {
+  struct timespec end;
+  if(latency == NULL)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  hist_record(&latency[phase], BILLION * (end.tv_sec - start->tv_sec) + end.tv_nsec - start->tv_nsec);
+}
+void divide_result_values(result *res, int divisor) {
+  // For results that summed several identical trials; only the sizes and counts are meaningful to divide.  Wall and CPU
+  // time stay as totals so the cell's cost covers every trial it ran.
+  res->blocks /= divisor;
+  res->raw_size /= divisor;
+  for(int id=0; id<CODEC_COUNT; id++) {
+    res->codecs[id].comp_size /= divisor;
+    res->codecs[id].codec_wall /= divisor;
+    for(int direction=0; direction<DIRECTIONS; direction++) {
+      res->codecs[id].faults[direction] /= divisor;
+      res->codecs[id].cpu_time[direction] /= divisor;
+      res->codecs[id].phase_wall[direction] /= divisor;
+      for(int counter=0; counter<PERF_EVENTS; counter++)
+        res->codecs[id].counters[direction][counter] /= divisor;
+    }
+  }
+}
+void merge_result(result *into, result *from) {
+  // Only called once *from's owner is finished with it (after pool_run(), or by the stream sink), so no locking.
+  into->blocks += from->blocks;
+  into->raw_size += from->raw_size;
+  into->wall_time += from->wall_time;
+  into->cpu_time += from->cpu_time;
+  for(int id=0; id<CODEC_COUNT; id++) {
+    into->codecs[id].comp_size += from->codecs[id].comp_size;
+    into->codecs[id].comp_time += from->codecs[id].comp_time;
+    into->codecs[id].decomp_time += from->codecs[id].decomp_time;
+    into->codecs[id].codec_wall += from->codecs[id].codec_wall;
+    for(int direction=0; direction<DIRECTIONS; direction++) {
+      into->codecs[id].faults[direction] += from->codecs[id].faults[direction];
+      into->codecs[id].cpu_time[direction] += from->codecs[id].cpu_time[direction];
+      into->codecs[id].phase_wall[direction] += from->codecs[id].phase_wall[direction];
+      if(from->codecs[id].entered[direction] > 0 &&
+         (into->codecs[id].entered[direction] == 0 || from->codecs[id].entered[direction] < into->codecs[id].entered[direction]))
+        into->codecs[id].entered[direction] = from->codecs[id].entered[direction];
+      if(from->codecs[id].left[direction] > into->codecs[id].left[direction])
+        into->codecs[id].left[direction] = from->codecs[id].left[direction];
+      for(int counter=0; counter<PERF_EVENTS; counter++)
+        into->codecs[id].counters[direction][counter] += from->codecs[id].counters[direction][counter];
+    }
+  }
+  if(into->latency != NULL && from->latency != NULL) {
+    for(int phase=0; phase<PHASE_COUNT; phase++)
+      hist_merge(&into->latency[phase], &from->latency[phase]);
+  }
+}
+static inline uint64_t thread_faults() {
+  // Minor plus major faults taken by the calling thread so far; read outside every clock and counter bracket.
+  struct rusage usage;
+  if(!REPORT_FAULTS && OUTPUT_FORMAT == FORMAT_TABLE)
+    return 0;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_minflt + usage.ru_majflt;
+}
+void prime_phase(codec *c, void *state, buffer *bufs, int64_t s_idx, int64_t e_idx, int direction) {
+  // Runs before a phase's clock starts.  The hot pre-pass throws its results away; the timed pass redoes (and checks)
+  // every block.
+  if(CACHE_MODE == CACHE_COLD || CACHE_MODE == CACHE_EVICT)
+    chill_phase(bufs, s_idx, e_idx, direction);
+  for(int64_t i=s_idx; i<=e_idx && CACHE_MODE == CACHE_HOT; i++) {
+    if(direction == PHASE_COMP)
+      bufs[i].comp_size = c->compress(c, state, &bufs[i]);
+    else
+      c->decompress(c, state, &bufs[i]);
+  }
+}
+void phase_enter(phase_sync *sync) {
+  if(sync == NULL)
+    return;
+  if(pthread_barrier_wait(&sync->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    clock_gettime(CLOCK_MONOTONIC, &sync->start);
+}
+void phase_leave(phase_sync *sync, int phase) {
+  // The closing barrier only returns once the slowest worker is done, so its serial thread reads the phase's wall time.
+  struct timespec end;
+  if(sync == NULL)
+    return;
+  if(pthread_barrier_wait(&sync->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sync->wall[phase] += BILLION * (end.tv_sec - sync->start.tv_sec) + end.tv_nsec - sync->start.tv_nsec;
+  }
+}
+static inline void phase_span(codec_result *out, int direction, struct timespec *start, struct timespec *end) {
+  // Widens this trial's [entered, left] window for the phase; merge_result() widens it across workers the same way.
+  uint64_t from = BILLION * start->tv_sec + start->tv_nsec, to = BILLION * end->tv_sec + end->tv_nsec;
+  if(out->entered[direction] == 0 || from < out->entered[direction])
+    out->entered[direction] = from;
+  if(to > out->left[direction])
+    out->left[direction] = to;
+}
+void run_codec(result *res, int codec_id, buffer *bufs, int64_t s_idx, int64_t e_idx, phase_sync *sync) {
+  // The one timing loop.  Every block of the range is compressed, then every block decompressed, each direction inside
+  // its own clock/counter bracket.  Errors are only checked outside the brackets.  With a sync every worker enters and
+  // leaves each direction together (an empty range still has to show up at the barriers).
+  struct timespec start, end, block, cpu_start, cpu_end;
+  codec *c = &codecs[codec_id];
+  void *state = codec_states[codec_id];
+  codec_result *out = &res->codecs[codec_id];
+  histogram *lat = res->latency == NULL ? NULL : &res->latency[codec_id * DIRECTIONS];
+  int errors = 0;
+  uint64_t faults = 0;
+
+  // Compress Time
+  prime_phase(c, state, bufs, s_idx, e_idx, PHASE_COMP);
+  phase_enter(sync);
+  faults = thread_faults();
+  perf_begin();
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int64_t i=s_idx; i<=e_idx; i++) {
+    block_start(lat, &block);
+    bufs[i].comp_size = c->compress(c, state, &bufs[i]);
+    block_end(lat, PHASE_COMP, &block);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  perf_end(out->counters[PHASE_COMP]);
+  out->cpu_time[PHASE_COMP] += BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+  phase_leave(sync, codec_id * DIRECTIONS + PHASE_COMP);
+  out->faults[PHASE_COMP] += thread_faults() - faults;
+  out->comp_time += BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+  phase_span(out, PHASE_COMP, &start, &end);
+  // Validation and Size Storage
+  for(int64_t i=s_idx; i<=e_idx; i++) {
+    if(bufs[i].comp_size < 0)
+      fatal(E_GENERIC, "%s%s%s%ld%s", "Ran into a compression problem with ", c->name, " (buffer id: ", i, ").");
+    out->comp_size += bufs[i].comp_size;
+  }
+
+  // Decompress Time
+  prime_phase(c, state, bufs, s_idx, e_idx, PHASE_DECOMP);
+  phase_enter(sync);
+  faults = thread_faults();
+  perf_begin();
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int64_t i=s_idx; i<=e_idx; i++) {
+    block_start(lat, &block);
+    errors += c->decompress(c, state, &bufs[i]) != (int64_t)bufs[i].raw_size;
+    block_end(lat, PHASE_DECOMP, &block);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  perf_end(out->counters[PHASE_DECOMP]);
+  out->cpu_time[PHASE_DECOMP] += BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+  phase_leave(sync, codec_id * DIRECTIONS + PHASE_DECOMP);
+  out->faults[PHASE_DECOMP] += thread_faults() - faults;
+  out->decomp_time += BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+  phase_span(out, PHASE_DECOMP, &start, &end);
+  if(errors > 0)
+    fatal(E_GENERIC, "%s%s%s%i%s", "Ran into a decompression problem with ", c->name, " (errors: ", errors, ").");
+}
+unsigned shuffle_key(src_file *src, uint64_t block_size, uint64_t range) {
+  // FNV-1a over what a range of blocks is (file relative to the scan root, block size, and the trial or block number),
+  // so its codec order doesn't depend on which worker ran it or when.
+  uint64_t hash = 14695981039346656037ULL;
+  for(char *c=src->name; *c!='\0'; c++)
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  hash = (hash ^ block_size) * 1099511628211ULL;
+  hash = (hash ^ range) * 1099511628211ULL;
+  return (unsigned)(hash ^ (hash >> 32));
+}
+void codec_order(int *order, unsigned key) {
+  // --codecs order, or a Fisher-Yates shuffle of it drawn from SHUFFLE_SEED and the range's key alone, so the same seed
+  // gives every range the same order again however the work lands on threads.
+  unsigned state = SHUFFLE_SEED ^ key;
+  int swap = 0, pick = 0;
+  for(int id=0; id<CODEC_COUNT; id++)
+    order[id] = id;
+  if(!SHUFFLE_CODECS)
+    return;
+  for(int i=CODEC_COUNT-1; i>0; i--) {
+    pick = rand_r(&state) % (i + 1);
+    swap = order[i];
+    order[i] = order[pick];
+    order[pick] = swap;
+  }
+}
+void run_test(result *res, buffer *bufs, int64_t s_idx, int64_t e_idx, unsigned key) {
+  int order[MAX_CODECS];
+  if(e_idx < s_idx)
+    return;  // More workers than blocks; nothing for this one to do.
+  res->blocks += e_idx - s_idx + 1;
+  for(int64_t i=s_idx; i<=e_idx; i++)
+    res->raw_size += bufs[i].raw_size;
+  // Run the tests.  To reduce the effects of caching-warming we use one compressor at a time (see --cache for the rest).
+  codec_order(order, key);
+  for(int i=0; i<CODEC_COUNT; i++)
+    run_codec(res, order[i], bufs, s_idx, e_idx, NULL);
+}
+int64_t take_chunk(chunk_deque *deques, int worker_id, int *stolen) {
+  // Owner first, from the front.  Once our own deque is dry, walk the others and steal one chunk from the back.
+  int64_t chunk = -1;
+  chunk_deque *victim = NULL;
+  for(int i=0; i<THREADS && chunk == -1; i++) {
+    victim = &deques[(worker_id + i) % THREADS];
+    pthread_mutex_lock(&victim->lock);
+    if(victim->head < victim->tail)
+      chunk = (i == 0) ? victim->head++ : --victim->tail;
+    pthread_mutex_unlock(&victim->lock);
+    *stolen = (i != 0);
+  }
+  return chunk;
+}
+void run_test_wrapper(test_wrapper *wrappers, int worker_id) {
+  // Phase-major, like run_test(): a worker only moves on to the next codec once every chunk of this one has finished, not
+  // just been taken, since codecs share each block's compressed buffer and size.  The barrier also keeps codecs from
+  // running over data an earlier codec just pulled into cache.  Each codec has its own deques, so stealing happens per
+  // codec.  A worker's blocks are the ones it ran of the first.
+  test_wrapper *wrapper = &wrappers[worker_id];
+  struct timespec start, end, cpu_start, cpu_end;
+  int64_t chunk = 0, s_idx = 0, e_idx = 0;
+  int stolen = 0, codec_id = 0;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  for(int i=0; i<CODEC_COUNT; i++) {
+    codec_id = wrapper->order[i];
+    while((chunk = take_chunk(wrapper->deques + codec_id * THREADS, worker_id, &stolen)) != -1) {
+      s_idx = chunk * wrapper->chunk_blocks;
+      e_idx = s_idx + wrapper->chunk_blocks - 1;
+      if(e_idx >= (int64_t)wrapper->buffer_count)
+        e_idx = wrapper->buffer_count - 1;
+      if(i == 0) {
+        wrapper->res->blocks += e_idx - s_idx + 1;
+        for(int64_t b=s_idx; b<=e_idx; b++)
+          wrapper->res->raw_size += wrapper->set[b].raw_size;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      run_codec(wrapper->res, codec_id, wrapper->set, s_idx, e_idx, NULL);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      wrapper->busy_time += BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+      wrapper->chunks_run++;
+      wrapper->chunks_stolen += stolen;
+    }
+    pthread_barrier_wait(wrapper->codec_done);
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  wrapper->res->cpu_time += BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+}
+void sync_test_wrapper(test_wrapper *wrappers, int worker_id) {
+  // --sync-phases: no stealing (a phase can't end until every block of it is done anyway), just an even static split and
+  // the shared codec order, one phase at a time in lockstep.
+  test_wrapper *wrapper = &wrappers[worker_id];
+  struct timespec start, end, cpu_start, cpu_end;
+  int64_t s_idx = (worker_id * wrapper->buffer_count) / THREADS;
+  int64_t e_idx = ((worker_id + 1) * wrapper->buffer_count) / THREADS - 1;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  wrapper->res->blocks += e_idx - s_idx + 1;
+  for(int64_t i=s_idx; i<=e_idx; i++)
+    wrapper->res->raw_size += wrapper->set[i].raw_size;
+  for(int i=0; i<CODEC_COUNT; i++)
+    run_codec(wrapper->res, wrapper->order[i], wrapper->set, s_idx, e_idx, wrapper->sync);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  wrapper->busy_time += BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+  wrapper->chunks_run = e_idx >= s_idx;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  wrapper->res->cpu_time += BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+}
+uint64_t carve_buffers(workspace *ws, src_file *src, uint64_t block_size) {
+  // Carve the buffers out of the workspace's arena.  The caller reserved enough for the largest block size of this file.
+  uint64_t buffer_count = src->size / block_size;
+  buffer *bufs = NULL;
+  if(src->size % block_size > 0)
+    buffer_count++;
+  if(buffer_count > ws->capacity) {
+    ws->bufs = realloc(ws->bufs, buffer_count * sizeof(buffer));
+    if(ws->bufs == NULL)
+      fatal(E_GENERIC, "%s%lu%s", "Failed to allocate ", buffer_count, " block buffers.");
+    ws->capacity = buffer_count;
+  }
+  bufs = ws->bufs;
+  arena_reset(&ws->arena);
+  for(uint64_t i=0; i<buffer_count; i++) {
+    bufs[i].comp_size = 0;
+    bufs[i].raw_size = block_size;
+    if(i + 1 == buffer_count && src->size % block_size > 0)
+      bufs[i].raw_size = src->size % block_size;
+    bufs[i].comp_bound = max_compress_bound(bufs[i].raw_size);
+    if(src->mapped) {
+      bufs[i].raw = src->data + i * block_size;
+    } else {
+      // Stage slurped blocks into their own aligned slices, outside any timed phase.
+      bufs[i].raw = arena_alloc(&ws->arena, bufs[i].raw_size);
+      memcpy(bufs[i].raw, src->data + i * block_size, bufs[i].raw_size);
+    }
+    bufs[i].compressed = arena_alloc(&ws->arena, bufs[i].comp_bound);
+    bufs[i].decompressed = arena_alloc(&ws->arena, bufs[i].raw_size);
+  }
+  if(PREFAULT) {
+    prefault_region(ws->arena.base, ws->arena.used, 1);
+    if(src->mapped)
+      prefault_region(src->data, src->size, 0);
+  }
+  return buffer_count;
+}
+int more_trials(int trials, uint64_t total_time) {
+  return trials < TRIALS || (total_time < (uint64_t)MIN_TIME_MS * MILLION && trials < MAX_TRIALS);
+}
+void trial_begin(result *res, uint64_t *samples[], int trial) {
+  // The cell result accumulates every trial; each phase's per-trial time is captured as the difference.  Its wall window
+  // starts over so it only spans this trial.
+  codec_result *cr = NULL;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    samples[phase] = realloc(samples[phase], (trial + 1) * sizeof(uint64_t));
+    samples[phase][trial] = *phase_time(res, phase);
+    cr = &res->codecs[phase / DIRECTIONS];
+    cr->entered[phase % DIRECTIONS] = 0;
+    cr->left[phase % DIRECTIONS] = 0;
+  }
+}
+void trial_end(result *res, uint64_t *samples[], int trial) {
+  codec_result *cr = NULL;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    samples[phase][trial] = *phase_time(res, phase) - samples[phase][trial];
+    cr = &res->codecs[phase / DIRECTIONS];
+    cr->phase_wall[phase % DIRECTIONS] += cr->left[phase % DIRECTIONS] - cr->entered[phase % DIRECTIONS];
+  }
+  for(int id=0; id<CODEC_COUNT; id++) {
+    cr = &res->codecs[id];
+    cr->codec_wall += (cr->left[PHASE_COMP] > cr->left[PHASE_DECOMP] ? cr->left[PHASE_COMP] : cr->left[PHASE_DECOMP]) -
+                      (cr->entered[PHASE_COMP] < cr->entered[PHASE_DECOMP] ? cr->entered[PHASE_COMP] : cr->entered[PHASE_DECOMP]);
+  }
+}
+void fold_trials(result *res, uint64_t *samples[], int trials, trial_stats stats[]) {
+  // Fold the trials back into one row: sizes are identical every trial, times become the (outlier-free) median.
+  divide_result_values(res, trials);
+  res->trials = trials;
+  for(int phase=0; phase<PHASE_COUNT; phase++) {
+    summarize_trials(samples[phase], trials, &stats[phase]);
+    *phase_time(res, phase) = stats[phase].median;
+    free(samples[phase]);
+    samples[phase] = NULL;
+  }
+}
+void print_cell(result *res, trial_stats stats[], int trials) {
+  print_result(res);
+  print_variant_deltas(res);
+  if(trials > 1)
+    print_trial_stats(res, stats);
+  print_latency(res);
+  print_counters(res);
+  print_faults(res);
+  print_cpu_costs(res);
+}
+void compression_test(src_file *src, uint64_t block_size, result *total) {
   // Locals
-  src_file files[MAX_FILES];
+  result res;
+  uint64_t buffer_count = carve_buffers(&main_space, src, block_size);
+
+  // Each worker accumulates into its own cache-line-aligned slot; they're summed once after the pool finishes.
+  result slots[THREADS];
+  init_result(&res, src, block_size);
+  if(LATENCY)
+    track_latency(&res);
+  for(int i=0; i<THREADS; i++) {
+    init_result(&slots[i], src, block_size);
+    if(LATENCY)
+      track_latency(&slots[i]);
+  }
+
+  // Cut the blocks into chunks and deal each worker a contiguous run of them, once per codec.  Workers that finish early
+  // (e.g. a share of zeros) steal from the back of the others' deques.  Single-threaded is one worker with the whole
+  // file as its one chunk, so each codec compresses every block before decompressing any, just like run_test().
+  test_wrapper wrappers[THREADS];
+  chunk_deque deques[CODEC_COUNT * THREADS];
+  int order[MAX_CODECS];
+  phase_sync sync;
+  pthread_barrier_t codec_done;
+  struct timespec start, end;
+  uint64_t wall_time = 0;
+  uint64_t *samples[PHASE_COUNT];
+  trial_stats stats[PHASE_COUNT];
+  uint64_t chunk_blocks = CHUNK_BLOCKS;
+  int64_t chunk_count = 0;
+  int trials = 0;
+  if(chunk_blocks == 0)
+    chunk_blocks = THREADS == 1 ? buffer_count : buffer_count / (THREADS * CHUNKS_PER_WORKER);
+  if(chunk_blocks < 1)
+    chunk_blocks = 1;
+  chunk_count = (int64_t)((buffer_count + chunk_blocks - 1) / chunk_blocks);
+  for(int i=0; i<CODEC_COUNT * THREADS; i++)
+    pthread_mutex_init(&deques[i].lock, NULL);
+  for(int phase=0; phase<PHASE_COUNT; phase++)
+    samples[phase] = NULL;
+  pthread_barrier_init(SYNC_PHASES ? &sync.barrier : &codec_done, NULL, THREADS);
+
+  // Each trial reuses the buffers carved above; only the deques, wrappers and worker slots are reset.
+  while(more_trials(trials, res.wall_time)) {
+    for(int i=0; i<CODEC_COUNT * THREADS; i++) {
+      deques[i].head = ((((i % THREADS)+0) * chunk_count) / THREADS);
+      deques[i].tail = ((((i % THREADS)+1) * chunk_count) / THREADS);
+    }
+    codec_order(order, shuffle_key(src, block_size, trials));
+    for(int i=0; i<THREADS; i++) {
+      // Set up the wrapper with points and static values.
+      wrappers[i].block_size = block_size;
+      wrappers[i].buffer_count = buffer_count;
+      clear_result_values(&slots[i]);
+      wrappers[i].res = &slots[i];
+      wrappers[i].set = main_space.bufs;
+      wrappers[i].deques = deques;
+      wrappers[i].chunk_blocks = chunk_blocks;
+      wrappers[i].order = order;
+      wrappers[i].busy_time = 0;
+      wrappers[i].sync = SYNC_PHASES ? &sync : NULL;
+      wrappers[i].codec_done = &codec_done;
+      wrappers[i].chunks_run = 0;
+      wrappers[i].chunks_stolen = 0;
+    }
+    if(SYNC_PHASES)
+      memset(sync.wall, 0, sizeof(sync.wall));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool_run(&workers, (pool_job) (SYNC_PHASES ? &sync_test_wrapper : &run_test_wrapper), wrappers);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    wall_time = BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+    trial_begin(&res, samples, trials);
+    for(int i=0; i<THREADS; i++)
+      merge_result(&res, &slots[i]);
+    for(int phase=0; phase<PHASE_COUNT && SYNC_PHASES; phase++) {
+      // merge_result() summed every worker's own phase clock; the one barrier-to-barrier wall time replaces that sum.
+      *phase_time(&res, phase) = samples[phase][trials] + sync.wall[phase];
+    }
+    trial_end(&res, samples, trials);
+    res.wall_time += wall_time;
+    trials++;
+  }
+  for(int i=0; i<CODEC_COUNT * THREADS; i++)
+    pthread_mutex_destroy(&deques[i].lock);
+  pthread_barrier_destroy(SYNC_PHASES ? &sync.barrier : &codec_done);
+  if(!SYNC_PHASES && chunk_count > 1) {
+    // Every chunk is compressed and then decompressed, so with several chunks the two directions' windows overlap and
+    // neither is the phase's own wall time.  The codec's window still is, since codecs meet at a barrier in between.
+    for(int id=0; id<CODEC_COUNT; id++)
+      memset(res.codecs[id].phase_wall, 0, sizeof(res.codecs[id].phase_wall));
+  }
+  fold_trials(&res, samples, trials, stats);
+
+  // Print results.  The arena slices are simply abandoned; the next block size rewinds over them.  Per-worker numbers
+  // are from the last trial.
+  print_cell(&res, stats, trials);
+  if(PER_THREAD) {
+    for(int i=0; i<THREADS; i++)
+      print_worker_result(i, &slots[i]);
+  }
+  if(THREADS > 1 && SYNC_PHASES) {
+    // Whatever a worker spent outside its own phase clocks was (mostly) waiting at the barriers for the slowest one.
+    char *keys[5] = {"worker", "cpu", "in_phases_ns", "at_barriers_ns", "blocks"};
+    double values[5];
+    for(int i=0; i<THREADS; i++) {
+      uint64_t phases = 0;
+      for(int phase=0; phase<PHASE_COUNT; phase++)
+        phases += *phase_time(&slots[i], phase);
+      values[0] = i;
+      values[1] = PIN_CPUS[i];
+      values[2] = phases;
+      values[3] = wrappers[i].busy_time > phases ? wrappers[i].busy_time - phases : 0;
+      values[4] = slots[i].blocks;
+      if(OUTPUT_FORMAT != FORMAT_TABLE)
+        emit_detail("worker", &res, -1, 5, keys, values);
+      print_note("  worker %2i (cpu %3i): in phases %'12i uS  at barriers %'12i uS  blocks %6lu", i, PIN_CPUS[i],
+        ns_to_us(phases), ns_to_us(wrappers[i].busy_time > phases ? wrappers[i].busy_time - phases : 0), slots[i].blocks);
+    }
+    print_cell_times(&res, trials);
+  } else if(THREADS > 1) {
+    // Idle is whatever part of the cell's wall time a worker wasn't inside run_test(): waiting to steal, or done early.
+    char *keys[7] = {"worker", "cpu", "busy_ns", "idle_ns", "chunk_runs", "stolen", "chunk_blocks"};
+    double values[7];
+    for(int i=0; i<THREADS; i++) {
+      values[0] = i;
+      values[1] = PIN_CPUS[i];
+      values[2] = wrappers[i].busy_time;
+      values[3] = wall_time > wrappers[i].busy_time ? wall_time - wrappers[i].busy_time : 0;
+      values[4] = wrappers[i].chunks_run;
+      values[5] = wrappers[i].chunks_stolen;
+      values[6] = chunk_blocks;
+      if(OUTPUT_FORMAT != FORMAT_TABLE)
+        emit_detail("worker", &res, -1, 7, keys, values);
+      print_note("  worker %2i (cpu %3i): busy %'12i uS  idle %'12i uS  chunk runs %6i (%i stolen, %lu blocks each)",
+        i, PIN_CPUS[i], ns_to_us(wrappers[i].busy_time),
+        ns_to_us(wall_time > wrappers[i].busy_time ? wall_time - wrappers[i].busy_time : 0),
+        wrappers[i].chunks_run, wrappers[i].chunks_stolen, chunk_blocks);
+    }
+    print_cell_times(&res, trials);
+  }
+  if(total != NULL)
+    merge_result(total, &res);
+  free_result(&res);
+  for(int i=0; i<THREADS; i++)
+    free_result(&slots[i]);
+}
+
+
+
+/*
+ *  Cell-parallel mode for corpora of many small files.  Instead of splitting one cell's blocks across the pool, each
+ *  worker takes whole (file, block size) cells from a shared queue and runs them on its own, in its own workspace, so
+ *  a 40 KB file no longer leaves THREADS - 1 cores idle.  Cells finish out of order; each is printed as soon as every
+ *  earlier cell has been, so the output reads exactly like the block-parallel run.
+ */
+void cell_test(cell *c, workspace *ws) {
+  // One cell, start to finish, on the calling worker.
+  struct timespec start, end, cpu_start, cpu_end;
+  uint64_t *samples[PHASE_COUNT];
+  uint64_t buffer_count = 0;
+  arena_reserve(&ws->arena, arena_size_for(c->src));
+  buffer_count = carve_buffers(ws, c->src, c->block_size);
+  c->res = malloc(sizeof(result));
+  c->stats = malloc(PHASE_COUNT * sizeof(trial_stats));
+  if(c->res == NULL || c->stats == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate a cell result.");
+  init_result(c->res, c->src, c->block_size);
+  if(LATENCY)
+    track_latency(c->res);
+  for(int phase=0; phase<PHASE_COUNT; phase++)
+    samples[phase] = NULL;
+  c->trials = 0;
+  while(more_trials(c->trials, c->res->wall_time)) {
+    trial_begin(c->res, samples, c->trials);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_test(c->res, ws->bufs, 0, buffer_count - 1, shuffle_key(c->src, c->block_size, c->trials));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    trial_end(c->res, samples, c->trials);
+    c->res->wall_time += BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+    c->res->cpu_time += BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+    c->trials++;
+  }
+  fold_trials(c->res, samples, c->trials, c->stats);
+}
+void flush_cells(cell_queue *q) {
+  // Caller holds q->lock.  Print every finished cell that is next in line, then free it.
+  cell *c = NULL;
+  char *keys[5] = {"worker", "cpu", "wall_ns", "cpu_ns", "trials"};
+  double values[5];
+  while(q->printed < q->cell_count && q->cells[q->printed].done) {
+    c = &q->cells[q->printed];
+    print_cell(c->res, c->stats, c->trials);
+    values[0] = c->worker_id;
+    values[1] = PIN_CPUS[c->worker_id];
+    values[2] = c->res->wall_time;
+    values[3] = c->res->cpu_time;
+    values[4] = c->trials;
+    if(OUTPUT_FORMAT != FORMAT_TABLE)
+      emit_detail("worker", c->res, -1, 5, keys, values);
+    print_note("  cell on worker %2i (cpu %3i): wall %'i uS  cpu %'i uS over %i trial(s)", c->worker_id,
+      PIN_CPUS[c->worker_id], ns_to_us(c->res->wall_time), ns_to_us(c->res->cpu_time), c->trials);
+    if(q->totals != NULL)
+      merge_result(&q->totals[c->block_id], c->res);
+    if(c->block_id + 1 == BLOCK_SIZE_COUNT)
+      print_separator("|", blank);
+    free_result(c->res);
+    free(c->res);
+    free(c->stats);
+    c->res = NULL;
+    q->printed++;
+  }
+}
+void cell_worker(cell_queue *q, int worker_id) {
+  cell *c = NULL;
+  int file_done = 0;
+  while(1) {
+    pthread_mutex_lock(&q->lock);
+    c = q->next < q->cell_count ? &q->cells[q->next++] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    if(c == NULL)
+      break;
+    prefetch_wait(q->prefetch, c->file_index);
+    c->worker_id = worker_id;
+    cell_test(c, &q->spaces[worker_id]);
+    pthread_mutex_lock(&q->lock);
+    c->done = 1;
+    file_done = --q->remaining[c->file_index] == 0;
+    flush_cells(q);
+    pthread_mutex_unlock(&q->lock);
+    if(file_done)
+      prefetch_release(q->prefetch, c->file_index);
+  }
+}
+void cell_parallel_test(src_file *files, int file_count, prefetcher *prefetch, result *totals) {
+  cell_queue q;
+  q.cell_count = file_count * BLOCK_SIZE_COUNT;
+  q.cells = calloc(q.cell_count, sizeof(cell));
+  q.remaining = malloc(file_count * sizeof(int));
+  q.spaces = calloc(THREADS, sizeof(workspace));
+  if(q.cells == NULL || q.remaining == NULL || q.spaces == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the cell queue.");
+  for(int i=0; i<q.cell_count; i++) {
+    q.cells[i].file_index = i / BLOCK_SIZE_COUNT;
+    q.cells[i].block_id = i % BLOCK_SIZE_COUNT;
+    q.cells[i].src = &files[q.cells[i].file_index];
+    q.cells[i].block_size = block_size_for(q.cells[i].src, q.cells[i].block_id);
+  }
+  for(int i=0; i<file_count; i++)
+    q.remaining[i] = BLOCK_SIZE_COUNT;
+  q.next = 0;
+  q.printed = 0;
+  q.prefetch = prefetch;
+  q.totals = totals;
+  pthread_mutex_init(&q.lock, NULL);
+  pool_run(&workers, (pool_job) &cell_worker, &q);
+  pthread_mutex_destroy(&q.lock);
+  for(int i=0; i<THREADS; i++) {
+    arena_release(&q.spaces[i].arena);
+    free(q.spaces[i].bufs);
+  }
+  free(q.spaces);
+  free(q.remaining);
+  free(q.cells);
+}
+
+
+
+/*
+ *  Streaming pipeline for files that don't fit in memory.  A reader thread pread()s blocks into a fixed ring of slots,
+ *  THREADS workers run the full codec sequence on one block at a time, and a sink thread folds each block's numbers into
+ *  the cell's result and recycles the slot.  Only STREAM_DEPTH blocks are ever resident.  Note that each block runs
+ *  through every codec back-to-back, so later codecs see a warmer cache than in the whole-file mode.
+ */
+void queue_init(slot_queue *q, int capacity) {
+  q->items = malloc(capacity * sizeof(stream_slot *));
+  if(q->items == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate a stream queue.");
+  q->capacity = capacity;
+  q->head = 0;
+  q->count = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+void queue_destroy(slot_queue *q) {
+  free(q->items);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+}
+void queue_push(slot_queue *q, stream_slot *slot) {
+  pthread_mutex_lock(&q->lock);
+  while(q->count == q->capacity)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->count) % q->capacity] = slot;
+  q->count++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+stream_slot *queue_pop(slot_queue *q) {
+  stream_slot *slot = NULL;
+  pthread_mutex_lock(&q->lock);
+  while(q->count == 0)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  slot = q->items[q->head];
+  q->head = (q->head + 1) % q->capacity;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return slot;
+}
+void read_block(int fd, void *dest, uint64_t size, uint64_t offset, char *filespec) {
+  // pread() may come up short on big requests or signals; keep going until the block is full.
+  ssize_t got = 0;
+  while(size > 0) {
+    got = pread(fd, dest, size, offset);
+    if(got <= 0)
+      fatal(E_IO, "%s%s", "Failed to read a block while streaming: ", filespec);
+    dest = (char *)dest + got;
+    offset += got;
+    size -= got;
+  }
+}
+void stream_reader(stream_pipeline *pipeline) {
+  stream_slot *slot = NULL;
+  uint64_t tail = pipeline->src->size % pipeline->block_size;
+  for(uint64_t i=0; i<pipeline->block_count; i++) {
+    slot = queue_pop(&pipeline->free_slots);
+    slot->buf.raw_size = pipeline->block_size;
+    if(i + 1 == pipeline->block_count && tail > 0)
+      slot->buf.raw_size = tail;
+    slot->buf.comp_bound = max_compress_bound(slot->buf.raw_size);
+    slot->buf.comp_size = 0;
+    read_block(pipeline->fd, slot->buf.raw, slot->buf.raw_size, i * pipeline->block_size, pipeline->src->filespec);
+    clear_result_values(&slot->res);
+    slot->index = i;
+    queue_push(&pipeline->filled, slot);
+  }
+  // One poison pill per worker.
+  for(int i=0; i<THREADS; i++)
+    queue_push(&pipeline->filled, NULL);
+}
+void stream_worker(stream_pipeline *pipeline, int worker_id) {
+  struct timespec cpu_start, cpu_end;
+  stream_slot *slot = queue_pop(&pipeline->filled);
+  while(slot != NULL) {
+    slot->worker_id = worker_id;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    run_test(&slot->res, &slot->buf, 0, 0, shuffle_key(pipeline->src, pipeline->block_size, slot->index));
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    slot->res.cpu_time = BILLION * (cpu_end.tv_sec - cpu_start.tv_sec) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+    queue_push(&pipeline->done, slot);
+    slot = queue_pop(&pipeline->filled);
+  }
+}
+void stream_sink(stream_pipeline *pipeline) {
+  stream_slot *slot = NULL;
+  for(uint64_t i=0; i<pipeline->block_count; i++) {
+    slot = queue_pop(&pipeline->done);
+    merge_result(pipeline->res, &slot->res);
+    merge_result(&pipeline->worker_res[slot->worker_id], &slot->res);
+    if(pipeline->res->latency != NULL)
+      record_block_latency(pipeline->res, &slot->res);
+    queue_push(&pipeline->free_slots, slot);
+  }
+}
+void stream_test(src_file *src, uint64_t block_size, result *total) {
+  // Locals
+  result res;
+  result worker_res[THREADS];
+  stream_pipeline pipeline;
+  pthread_t reader, sink;
+  struct timespec start, end;
+  uint64_t block_bound = max_compress_bound(block_size);
+
+  // Set up the pipeline.  The arena only ever holds STREAM_DEPTH slots, regardless of file size.
+  pipeline.src = src;
+  pipeline.block_size = block_size;
+  pipeline.block_count = src->size / block_size;
+  if(src->size % block_size > 0)
+    pipeline.block_count++;
+  pipeline.res = &res;
+  pipeline.worker_res = worker_res;
+  pipeline.fd = open(src->filespec, O_RDONLY);
+  if(pipeline.fd == -1)
+    fatal(E_IO, "%s%s", "Unable to open file for streaming: ", src->filespec);
+  posix_fadvise(pipeline.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  init_result(&res, src, block_size);
+  if(LATENCY)
+    track_latency(&res);
+  for(int i=0; i<THREADS; i++)
+    init_result(&worker_res[i], src, block_size);
+  arena_reserve(&main_space.arena, STREAM_DEPTH * (2 * align_up(block_size, ARENA_ALIGN) + align_up(block_bound, ARENA_ALIGN)));
+  pipeline.slots = malloc(STREAM_DEPTH * sizeof(stream_slot));
+  if(pipeline.slots == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate stream slots.");
+  queue_init(&pipeline.free_slots, STREAM_DEPTH);
+  queue_init(&pipeline.filled, STREAM_DEPTH + THREADS);
+  queue_init(&pipeline.done, STREAM_DEPTH);
+  for(int i=0; i<STREAM_DEPTH; i++) {
+    pipeline.slots[i].buf.raw = arena_alloc(&main_space.arena, block_size);
+    pipeline.slots[i].buf.compressed = arena_alloc(&main_space.arena, block_bound);
+    pipeline.slots[i].buf.decompressed = arena_alloc(&main_space.arena, block_size);
+    init_result(&pipeline.slots[i].res, src, block_size);
+    queue_push(&pipeline.free_slots, &pipeline.slots[i]);
+  }
+  if(PREFAULT)
+    prefault_region(main_space.arena.base, main_space.arena.used, 1);
+
+  // Run all three stages and wait for the sink to account for every block.  The reader and sink are mostly blocked on
+  // I/O and queues, so they get plain threads; the compressors are the pinned pool.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&reader, NULL, (void *) &stream_reader, &pipeline);
+  pthread_create(&sink, NULL, (void *) &stream_sink, &pipeline);
+  pool_run(&workers, (pool_job) &stream_worker, &pipeline);
+  pthread_join(reader, NULL);
+  pthread_join(sink, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  res.wall_time = BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+
+  // Print results and clean up.  CPU time is the workers' alone; the reader and sink are I/O and bookkeeping.
+  print_result(&res);
+  print_variant_deltas(&res);
+  print_latency(&res);
+  print_counters(&res);
+  print_faults(&res);
+  print_cpu_costs(&res);
+  if(PER_THREAD) {
+    for(int i=0; i<THREADS; i++)
+      print_worker_result(i, &worker_res[i]);
+  }
+  if(THREADS > 1)
+    print_cell_times(&res, 0);
+  if(total != NULL)
+    merge_result(total, &res);
+  free_result(&res);
+  queue_destroy(&pipeline.free_slots);
+  queue_destroy(&pipeline.filled);
+  queue_destroy(&pipeline.done);
+  free(pipeline.slots);
+  close(pipeline.fd);
+}
+
+
+
+/*
+ *  Warm up the CPU to avoid skews from thottling.  Rather than a fixed spin, each pinned worker measures how many
+ *  iterations it manages per WARMUP_WINDOW_MS window and stops once the last WARMUP_WINDOWS windows agree to within
+ *  WARMUP_TOLERANCE percent (frequency has ramped and settled), or WARMUP_CAP seconds pass.
+ */
+int warmup_settled(double rates[], int windows) {
+  double low = rates[0], high = rates[0];
+  if(windows < WARMUP_WINDOWS)
+    return 0;
+  for(int i=1; i<WARMUP_WINDOWS; i++) {
+    if(rates[i] < low)
+      low = rates[i];
+    if(rates[i] > high)
+      high = rates[i];
+  }
+  return high > 0 && (high - low) * 100.0 / high <= WARMUP_TOLERANCE;
+}
+void waste_cpu_time(warmup_report *reports, int worker_id) {
+  // Using the LZ4 example (which I wrote years ago), repeatedly compress and decompress the
+  // same buffer to waste CPU time in a complex-enough manner to not be optimized-out by gcc.
+  warmup_report *report = &reports[worker_id];
+  struct timespec start, window_start, now;
+  double rates[WARMUP_WINDOWS];
+  uint64_t iterations = 0, window_ns = 0;
+  const char* const src = "Lorem ipsum dolor sit amet, consectetur adipiscing elit.";
+  const int src_size = (int)(strlen(src) + 1);
+  const int max_dst_size = LZ4_compressBound(src_size);
+  char* compressed_data = malloc(max_dst_size);
+  char* const regen_buffer = malloc(src_size);
+  const int compressed_data_size = LZ4_compress_default(src, compressed_data, src_size, max_dst_size);
+  report->windows = 0;
+  report->stable = 0;
+  report->rate = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  window_start = start;
+  now = start;
+  while((uint64_t)(BILLION * (now.tv_sec - start.tv_sec) + now.tv_nsec - start.tv_nsec) < (uint64_t)WARMUP_CAP * BILLION) {
+    // compresss it
+    LZ4_compress_default(src, compressed_data, src_size, max_dst_size);
+    // now decompress it... yep
+    LZ4_decompress_safe(compressed_data, regen_buffer, compressed_data_size, src_size);
+    // Only look at the clock every so often; it's cheap, but not free next to a 57 byte compress.
+    if(++iterations % 256 != 0)
+      continue;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    window_ns = BILLION * (now.tv_sec - window_start.tv_sec) + now.tv_nsec - window_start.tv_nsec;
+    if(window_ns < WARMUP_WINDOW_MS * MILLION)
+      continue;
+    // Window closed: slide the samples along and check whether they agree.
+    memmove(rates, rates + 1, (WARMUP_WINDOWS - 1) * sizeof(double));
+    rates[WARMUP_WINDOWS - 1] = (double)iterations * BILLION / window_ns;
+    report->rate = rates[WARMUP_WINDOWS - 1];
+    report->windows++;
+    iterations = 0;
+    window_start = now;
+    if(warmup_settled(rates, report->windows)) {
+      report->stable = 1;
+      break;
+    }
+  }
+  report->elapsed = BILLION * (now.tv_sec - start.tv_sec) + now.tv_nsec - start.tv_nsec;
+  free(compressed_data);
+  free(regen_buffer);
+}
+void warm_up() {
+  // Runs on the pinned pool so the cores we warm are the cores we measure.
+  warmup_report reports[THREADS];
+  pool_run(&workers, (pool_job) &waste_cpu_time, reports);
+  for(int i=0; i<THREADS; i++) {
+    fprintf(status_out, "  worker %2i (cpu %3i): %s %'.0f iterations/s after %.2f sec (%i windows)\n", i, PIN_CPUS[i],
+      reports[i].stable ? "steady at" : "NOT steady, last", reports[i].rate, (double)reports[i].elapsed / BILLION,
+      reports[i].windows);
+  }
+}
+
+
+
+/*
+ *  Main function, initialization point for program.
+ */
+int main(int argc, char **argv) {
+  // Locals
+  src_file *files = NULL;
+  prefetcher prefetch;
+  result *block_totals = NULL;  // Every file's cells summed per --block-sizes entry, for the end-of-run summaries.
   char *path;
   int file_count = 0;
   struct timespec start, end;
@@ -514,29 +3701,79 @@ int main(int argc, char **argv) {
 
   // 1.  Validate arguments.  Then load files into array (do NOT slurp here).
   validate(argc, argv);
-  path = argv[1];
-  THREADS = atoi(argv[2]);
-  scan_files(path, files, &file_count);
-
-  // 2.  Main loop to do our testing.
-  printf("Warming up the CPU for %d seconds.\n", WARMUP_SEC);
-  warm_up();
-  printf("Warmup complete.  Starting program.\n");
-  setlocale(LC_NUMERIC, "");
+  status_out = OUTPUT_FORMAT == FORMAT_TABLE ? stdout : stderr;
+  path = argv[optind];
+  THREADS = atoi(argv[optind + 1]);
+  scan_files(path, &files, &file_count);
+  if(PIN_CPU_COUNT == 0)
+    default_cpu_list(THREADS);
+  pool_start(&workers, THREADS);
+
+  // 2.  Main loop to do our testing.  Thousands separators are for people; csv/json keep the C locale so a decimal comma
+  //     never turns up in a number.
+  if(OUTPUT_FORMAT == FORMAT_TABLE)
+    setlocale(LC_NUMERIC, "");
+  if(codecs_need_dictionary()) {
+    train_dictionary(files, file_count);
+    codec_prepare_shared();
+    fprintf(status_out, "Dictionary: %'lu bytes trained from %'lu samples (%'lu KiB) in %'i uS; codecs digested it in %'i uS.\n",
+      corpus_dict.size, corpus_dict.samples, to_kib(corpus_dict.sample_bytes), ns_to_us(corpus_dict.build_time),
+      ns_to_us(corpus_dict.prepare_time));
+  }
+  if(WARMUP_CAP > 0) {
+    fprintf(status_out, "Warming up the CPU until throughput is steady within %.1f%% (at most %d seconds).\n",
+      WARMUP_TOLERANCE, WARMUP_CAP);
+    warm_up();
+  }
+  fprintf(status_out, "Warmup complete.  Starting program.\n");
+  evict_start();
   clock_gettime(CLOCK_MONOTONIC, &start);
+  block_totals = malloc(BLOCK_SIZE_COUNT * sizeof(result));
+  if(block_totals == NULL)
+    fatal(E_GENERIC, "%s", "Failed to allocate the per-block-size totals.");
+  for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++)
+    init_result(&block_totals[block_id], NULL, BLOCK_SIZES[block_id]);
+  prefetch_start(&prefetch, files, STREAM_DEPTH > 0 ? 0 : file_count);  // Streaming reads its own blocks.
   print_header();
-  for(int i=0; i<file_count; i++) {
-    slurp_file(&files[i]);
-    for(int block_id=0; block_id<BLOCK_COUNT; block_id++) {
-      compression_test(&files[i], block_sizes[block_id]);
+  if(CELL_PARALLEL)
+    cell_parallel_test(files, file_count, &prefetch, block_totals);
+  for(int i=0; i<file_count && !CELL_PARALLEL; i++) {
+    if(STREAM_DEPTH > 0) {
+      for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++)
+        stream_test(&files[i], block_size_for(&files[i], block_id), &block_totals[block_id]);
+      print_separator("|", blank);
+      continue;
+    }
+    prefetch_wait(&prefetch, i);
+    arena_reserve(&main_space.arena, arena_size_for(&files[i]));
+    for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++) {
+      compression_test(&files[i], block_size_for(&files[i], block_id), &block_totals[block_id]);
     }
     print_separator("|", blank);
-    unslurp_file(&files[i]);
+    prefetch_release(&prefetch, i);
+  }
+  prefetch_stop(&prefetch);
+  if(SWEEP) {
+    print_separator("+", hyphens);
+    for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++)
+      print_frontier(&block_totals[block_id]);
+  }
+  if(REUSE_CONTEXTS) {
+    print_separator("+", hyphens);
+    for(int block_id=0; block_id<BLOCK_SIZE_COUNT; block_id++)
+      print_reuse_summary(&block_totals[block_id]);
   }
   print_separator("+", hyphens);
   clock_gettime(CLOCK_MONOTONIC, &end);
+  arena_release(&main_space.arena);
+  free(main_space.bufs);
+  free(block_totals);
+  pool_stop(&workers);
+  codec_release_shared();
+  free(corpus_dict.content);
+  evict_stop();
   int total_ms = (BILLION * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec) / MILLION;
-  printf("Total test time: %'i ms (%i sec)\n", total_ms, (int)(total_ms / THOUSAND));
+  fprintf(status_out, "Total test time: %'i ms (%i sec)\n", total_ms, (int)(total_ms / THOUSAND));
 
   // All done.
   return 0;